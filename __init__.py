@@ -38,6 +38,10 @@ __email__ = 'lindroos@chalmers.se'
 PB_CONST = 0
 PB_MS = 1
 PB_FITS = 2
+PB_GAUSSIAN = 3
+PB_AIRY = 4
+
+PB_INTERP = {'nearest': 0, 'linear': 1, 'cubic': 2}
 
 FILETYPENAME = {}
 FILE_TYPE_NONE = 0
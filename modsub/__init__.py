@@ -28,9 +28,27 @@ c_modsub.argtype = [c_int, c_char_p, c_int,
                     c_int, c_char_p, c_int,
                     c_char_p,
                     c_int, c_char_p, POINTER(c_double), c_int,
-                    c_bool, c_bool]
-
-def modsub(model, vis, outvis='', datacolumn='corrected', primarybeam='guess', subtract=True, use_cuda=False, field = None):
+                    c_bool, c_bool, c_bool, c_char_p,
+                    c_bool, c_double, c_int,
+                    c_bool,
+                    c_int, c_int, c_int]
+
+def modsub(model, vis, outvis='', datacolumn='corrected', primarybeam='guess', subtract=True, use_cuda=False, field = None,
+           gridded=False, cell=None, imsize=None, skipflagged=False,
+           nthread=None, nchunk=None, chunksize=None):
+    """
+    Subtract a component list model from vis.
+
+    gridded: Predict point components from an FFT of the model image 
+             instead of summing them for each visibility, faster for
+             large component lists.
+    cell, imsize: Cell size in radians and size in pixels of the model
+                  image for gridded, chosen automatically if None.
+    skipflagged: Leave data where every channel and correlation of a 
+                 block is flagged unchanged, saves time on heavily 
+                 flagged data. By default the model is subtracted from 
+                 all data, flagged or not.
+    """
     import shutil
     import os
 
@@ -61,7 +79,11 @@ def modsub(model, vis, outvis='', datacolumn='corrected', primarybeam='guess', s
                     c_char_p(model), 
                     pbtype, c_char_p(pbfile), pbpars, pbnpars,
                     c_bool(subtract), c_bool(use_cuda),
-                    c_bool(select_field), c_char_p(field))
+                    c_bool(select_field), c_char_p(field),
+                    c_bool(gridded), c_double(cell or 0.), c_int(imsize or 0),
+                    c_bool(skipflagged),
+                    c_int(nthread or 0), c_int(nchunk or 0),
+                    c_int(chunksize or 0))
     return 0
 
 
@@ -20,6 +20,7 @@ import math
 import numpy as np
 import stacker
 import os
+from ctypes import c_double
 
 def guesspb(vis):
     """
@@ -134,21 +135,92 @@ class GaussianPrimaryBeamModel(PrimaryBeamModel):
         return np.exp(-4.*np.log(2)*(dx**2+dy**2)/vp_fwhm**2)
 
 
+    def cdata(self):
+        """
+        Returns a version of the primary beam model that can be sent to c functions.
+        """
+        from taskinit import qa
+
+        pbtype = stacker.PB_GAUSSIAN
+        pbfile = ''
+        pbnpars = 2
+        pbpars = (c_double*pbnpars)(qa.convert(self.dishdia, 'm')['value'],
+                                    self.nu0 or 0.)
+        return pbtype, pbfile, pbnpars, pbpars
+
+
+class AiryPrimaryBeamModel(PrimaryBeamModel):
+    """ 
+    Primary beam model of a uniformly illuminated dish, an Airy pattern.
+    """
+    def __init__(self, dishdia='12m', nu0=None, *args, **kwargs):
+        """
+        Constructor
+
+        Keyword arguments:
+        dishdia -- Diamater of the telescope dish
+        """
+        super(AiryPrimaryBeamModel, self).__init__(*args, **kwargs)
+        self.dishdia = dishdia
+        self.nu0 = nu0
+
+    def __call__(self, dx, dy, nu=None):
+        """
+        Returns primary beam correction for translation (dx, dy) from center.
+
+        Keyword arguments:
+        dx -- Projected separation in x direction in radians
+        dy -- Projected separation in y direction in radians
+        nu -- Frequency, either self.nu0 or nu must be set.
+        """
+        from scipy.constants import c
+        from scipy.special import j1
+        from taskinit import qa
+
+        if nu is None:
+            if self.nu0 is None:
+                return 0.
+            nu = self.nu0
+
+        dishdia = qa.convert(self.dishdia, 'm')['value']
+        v = np.pi*dishdia*nu/c*np.sqrt(dx**2+dy**2)
+        if v < 1e-6:
+            return 1.
+        return (2.*j1(v)/v)**2
+
+
+    def cdata(self):
+        """
+        Returns a version of the primary beam model that can be sent to c functions.
+        """
+        from taskinit import qa
+
+        pbtype = stacker.PB_AIRY
+        pbfile = ''
+        pbnpars = 2
+        pbpars = (c_double*pbnpars)(qa.convert(self.dishdia, 'm')['value'],
+                                    self.nu0 or 0.)
+        return pbtype, pbfile, pbnpars, pbpars
+
+
 class MSPrimaryBeamModel(PrimaryBeamModel):
     """ 
     Primary beam model based on casa image. 
     """
 
-    def __init__(self, imagename, *args, **kwargs):
+    def __init__(self, imagename, interpolation='linear', *args, **kwargs):
         """
         Constructor
 
         Keyword arguments:
         imagename -- Str to casa image of primary beam
+        interpolation -- Interpolation of the image in the c library,
+                         'nearest', 'linear' or 'cubic'.
         """
         super(MSPrimaryBeamModel, self).__init__(*args, **kwargs)
 
         self.imagename = imagename
+        self.interpolation = interpolation
 
         try:
             from taskinit import ia
@@ -223,7 +295,7 @@ class MSPrimaryBeamModel(PrimaryBeamModel):
         """
         pbtype = stacker.PB_MS
         pbfile = self.imagename
-        pbnpars = 0
-        pbpars = None
+        pbnpars = 1
+        pbpars = (c_double*pbnpars)(stacker.PB_INTERP[self.interpolation])
         return pbtype, pbfile, pbnpars, pbpars
 
@@ -0,0 +1,326 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#include "AveragingDataIO.h"
+#include "definitions.h"
+
+using std::cout;
+using std::endl;
+
+AveragingDataIO::AveragingDataIO(DataIO* dataio, const double* x, /*{{{*/
+                                 const double* y, int npos, float tolerance,
+                                 PrimaryBeam* pb)
+	: DataIO()
+{
+	this->dataio = dataio;
+	input = NULL;
+	inputDone = false;
+	nread = 0;
+	nwritten = 0;
+
+	float minfreq = 0., maxfreq = 0.;
+	for(size_t spw = 0; spw < dataio->nSpw(); spw++)
+	{
+		float* freq = dataio->getFreq(spw);
+		for(size_t chan = 0; chan < dataio->nChan(); chan++)
+		{
+			if(freq[chan] <= 0.)
+				continue;
+			if(minfreq == 0. or freq[chan] < minfreq)
+				minfreq = freq[chan];
+			maxfreq = std::max(maxfreq, freq[chan]);
+		}
+	}
+
+	// Positions outside the cutoff are not stacked in Coords either.
+	float cutoff = -1.;
+	if(pb != NULL)
+		cutoff = pb->cutoffRadius(0.001, minfreq);
+
+	// Phase of a position at offset r changes by 2*pi/c*freq*r*duv when
+	// the uv point moves by duv.
+	double maxPhase = sqrt(24.*tolerance);
+	for(int fieldID = 0; fieldID < dataio->nPointings(); fieldID++)
+	{
+		double x0 = dataio->xPhaseCentre(fieldID);
+		double y0 = dataio->yPhaseCentre(fieldID);
+		double r = 0.;
+		for(int i = 0; i < npos; i++)
+		{
+			double cosr = sin(y0)*sin(y[i]) + cos(y0)*cos(y[i])*cos(x[i]-x0);
+			double dist = acos(std::max(-1., std::min(1., cosr)));
+			if(cutoff < 0. or dist <= cutoff)
+				r = std::max(r, dist);
+		}
+
+		if(r > 0. and maxfreq > 0.)
+		{
+			double span = maxPhase*c/(2*M_PI*maxfreq*r);
+			maxSpan2.push_back(span*span);
+		}
+		else
+			maxSpan2.push_back(1e30);
+	}
+}/*}}}*/
+
+AveragingDataIO::~AveragingDataIO()/*{{{*/
+{
+	for(std::map<Key, Group*>::iterator it = open.begin(); it != open.end(); it++)
+		delete it->second;
+	for(size_t i = 0; i < done.size(); i++)
+		delete done[i];
+	delete input;
+	delete dataio;
+}/*}}}*/
+
+size_t AveragingDataIO::nvis()
+{
+	return dataio->nvis();
+}
+
+size_t AveragingDataIO::readChunk(Chunk& chunk)/*{{{*/
+{
+	chunk.resetSize();
+	chunk.set_dataset_id(dataset_id);
+
+	if(input == NULL)
+		input = new Chunk(chunk.size(), chunk.get_layout(), false);
+
+	// Rows are read until enough groups are closed to fill the chunk.
+	while(done.size() < chunk.size() and not inputDone)
+	{
+		size_t n = dataio->readChunk(*input);
+		if(n == 0)
+		{
+			inputDone = true;
+			for(std::map<Key, Group*>::iterator it = open.begin(); 
+			    it != open.end(); it++)
+				done.push_back(it->second);
+			open.clear();
+			cout << "Averaged " << nread << " visibilities to " 
+			     << nwritten+done.size() << "." << endl;
+			break;
+		}
+
+		nread += n;
+		for(size_t row = 0; row < n; row++)
+			add(input->inVis[row], input->get_layout());
+	}
+
+	size_t n = std::min(done.size(), chunk.size());
+	if(n == 0)
+		return 0;
+
+	chunk.setSize(n);
+	chunk.reshape_data(dataio->nChan(), dataio->nStokes());
+	for(size_t row = 0; row < n; row++)
+	{
+		emit(done.front(), chunk, row);
+		delete done.front();
+		done.pop_front();
+	}
+	nwritten += n;
+	return n;
+}/*}}}*/
+
+void AveragingDataIO::add(Visibility& vis, int layout)/*{{{*/
+{
+	int nsamples = vis.nchan*vis.nstokes;
+	bool flagged = true;
+	for(int i = 0; i < nsamples; i++)
+		flagged &= vis.data_flag[i] != 0;
+	if(flagged)
+		return;
+
+	Key key(std::pair<int,int>(vis.fieldID, vis.spw),
+	        std::pair<int,int>(vis.antenna1, vis.antenna2));
+	std::map<Key, Group*>::iterator it = open.find(key);
+	Group* group = NULL;
+	if(it != open.end())
+	{
+		group = it->second;
+		double du = vis.u-group->u0, dv = vis.v-group->v0;
+		if(group->nchan != vis.nchan or group->nstokes != vis.nstokes or
+		   du*du+dv*dv > maxSpan2[vis.fieldID])
+		{
+			done.push_back(group);
+			open.erase(it);
+			group = NULL;
+		}
+	}
+
+	if(group == NULL)
+	{
+		group = new Group;
+		group->fieldID = vis.fieldID;
+		group->spw = vis.spw;
+		group->antenna1 = vis.antenna1;
+		group->antenna2 = vis.antenna2;
+		group->index = vis.index;
+		group->nchan = vis.nchan;
+		group->nstokes = vis.nstokes;
+		group->freq = vis.freq;
+		group->nrows = 0;
+		group->u0 = vis.u;
+		group->v0 = vis.v;
+		group->u = 0.;
+		group->v = 0.;
+		group->w = 0.;
+		group->re.assign(nsamples, 0.);
+		group->im.assign(nsamples, 0.);
+		group->weight.assign(nsamples, 0.);
+		open[key] = group;
+	}
+
+	group->nrows++;
+	group->u += vis.u;
+	group->v += vis.v;
+	group->w += vis.w;
+	for(int stokes = 0; stokes < vis.nstokes; stokes++)
+	{
+		for(int chan = 0; chan < vis.nchan; chan++)
+		{
+			int i = stokes*vis.nchan+chan;
+			if(vis.data_flag[i] or vis.weight[i] <= 0.)
+				continue;
+
+			float re, im;
+			if(layout == Chunk::layout_interleaved)
+			{
+				re = vis.data[chan*vis.nstokes+stokes].real();
+				im = vis.data[chan*vis.nstokes+stokes].imag();
+			}
+			else
+			{
+				re = vis.data_real[i];
+				im = vis.data_imag[i];
+			}
+			group->re[i] += vis.weight[i]*re;
+			group->im[i] += vis.weight[i]*im;
+			group->weight[i] += vis.weight[i];
+		}
+	}
+}/*}}}*/
+
+void AveragingDataIO::emit(Group* group, Chunk& chunk, size_t row)/*{{{*/
+{
+	Visibility& vis = chunk.inVis[row];
+	vis.u = float(group->u/group->nrows);
+	vis.v = float(group->v/group->nrows);
+	vis.w = float(group->w/group->nrows);
+	vis.fieldID = group->fieldID;
+	vis.spw = group->spw;
+	vis.antenna1 = group->antenna1;
+	vis.antenna2 = group->antenna2;
+	vis.index = group->index;
+	vis.nchan = group->nchan;
+	vis.nstokes = group->nstokes;
+	vis.freq = group->freq;
+
+	for(int stokes = 0; stokes < vis.nstokes; stokes++)
+	{
+		for(int chan = 0; chan < vis.nchan; chan++)
+		{
+			int i = stokes*vis.nchan+chan;
+			double weight = group->weight[i];
+			float re = 0., im = 0.;
+			if(weight > 0.)
+			{
+				re = float(group->re[i]/weight);
+				im = float(group->im[i]/weight);
+			}
+
+			if(chunk.get_layout() == Chunk::layout_interleaved)
+				vis.data[chan*vis.nstokes+stokes] = std::complex<float>(re, im);
+			else
+			{
+				vis.data_real[i] = re;
+				vis.data_imag[i] = im;
+			}
+			vis.weight[i] = float(weight);
+			vis.data_flag[i] = weight > 0. ? 0 : 1;
+		}
+	}
+
+	if(chunk.has_output())
+	{
+		Visibility& outVis = chunk.outVis[row];
+		outVis.fieldID = vis.fieldID;
+		outVis.spw = vis.spw;
+		outVis.index = vis.index;
+		outVis.nchan = vis.nchan;
+		outVis.nstokes = vis.nstokes;
+		outVis.freq = vis.freq;
+		std::copy(vis.weight, &vis.weight[vis.nchan*vis.nstokes], outVis.weight);
+		std::copy(vis.data_flag, &vis.data_flag[vis.nchan*vis.nstokes], 
+		          outVis.data_flag);
+	}
+}/*}}}*/
+
+void AveragingDataIO::writeChunk(Chunk& chunk)
+{
+	// Averaged rows do not correspond to rows in the data.
+}
+
+int AveragingDataIO::nPointings()
+{
+	return dataio->nPointings();
+}
+
+float AveragingDataIO::xPhaseCentre(int fieldID)
+{
+	return dataio->xPhaseCentre(fieldID);
+}
+
+float AveragingDataIO::yPhaseCentre(int fieldID)
+{
+	return dataio->yPhaseCentre(fieldID);
+}
+
+void AveragingDataIO::setPhaseCentre(int fieldID, double x, double y)
+{
+}
+
+size_t AveragingDataIO::nChan()
+{
+	return dataio->nChan();
+}
+
+size_t AveragingDataIO::nSpw()
+{
+	return dataio->nSpw();
+}
+
+size_t AveragingDataIO::nStokes()
+{
+	return dataio->nStokes();
+}
+
+float* AveragingDataIO::getFreq(int spw)
+{
+	return dataio->getFreq(spw);
+}
+
+double AveragingDataIO::maxBaseline()
+{
+	return dataio->maxBaseline();
+}
@@ -0,0 +1,100 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <map>
+#include <deque>
+#include <vector>
+
+#include "DataIO.h"
+#include "Chunk.h"
+#include "PrimaryBeam.h"
+
+#ifndef __AVERAGING_DATAIO_H__
+#define __AVERAGING_DATAIO_H__
+
+// Baseline dependent averaging of visibilities in time.
+//
+// Wraps another DataIO and averages consecutive rows of each baseline,
+// spectral window and field for as long as the phase of the farthest 
+// stacking position in the field changes by less than 
+// sqrt(24*tolerance) over the averaged rows. A linear phase change of
+// that size reduces the amplitude by at most the fractional tolerance.
+// Short baselines are therefore averaged much more than long ones.
+//
+// Averaged rows can not be written back, writeChunk does nothing, so 
+// this is only useful for computers that reduce the data to a result.
+// The wrapped DataIO is owned and deleted by the AveragingDataIO.
+class AveragingDataIO : public DataIO
+{
+	private:
+		struct Group
+		{
+			int fieldID, spw, antenna1, antenna2, index;
+			int nchan, nstokes;
+			float* freq;
+			int nrows;
+			// First uv point of the group, and sums of uvw.
+			float u0, v0;
+			double u, v, w;
+			// Weighted sums indexed [stokes*nchan+chan], as the weights
+			// in a Visibility.
+			std::vector<double> re, im, weight;
+		};
+		typedef std::pair<std::pair<int,int>, std::pair<int,int> > Key;
+
+		DataIO* dataio;
+		Chunk* input;
+		bool inputDone;
+		size_t nread, nwritten;
+
+		// Largest uv distance covered by a group, squared, in metres.
+		std::vector<double> maxSpan2;
+
+		std::map<Key, Group*> open;
+		std::deque<Group*> done;
+
+		void add(Visibility& vis, int layout);
+		void emit(Group* group, Chunk& chunk, size_t row);
+
+	public:
+		// x and y are the stacking positions in radians, and tolerance the
+		// largest accepted fractional loss of amplitude. Positions outside 
+		// the primary beam cutoff are ignored if pb is given.
+		AveragingDataIO(DataIO* dataio, const double* x, const double* y,
+		                int npos, float tolerance, PrimaryBeam* pb = NULL);
+		~AveragingDataIO();
+
+		// Number of rows before averaging, an upper limit.
+		size_t nvis();
+
+		size_t readChunk(Chunk& chunk);
+		void writeChunk(Chunk& chunk);
+
+		int nPointings();
+		float xPhaseCentre(int fieldID);
+		float yPhaseCentre(int fieldID);
+		void setPhaseCentre(int fieldID, double x, double y);
+
+		size_t nChan();
+		size_t nSpw();
+		size_t nStokes();
+		float* getFreq(int spw);
+		double maxBaseline();
+};
+
+#endif // inclusion guard
@@ -15,10 +15,18 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
 //
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
 #include "CachedDataIO.h"
 #include "definitions.h"
 
-CachedDataIO::CachedDataIO(DataIO* dataio, size_t max_chunks) : DataIO(), max_chunks_(max_chunks)
+using std::cout;
+using std::endl;
+
+CachedDataIO::CachedDataIO(DataIO* dataio, double max_bytes) : DataIO()/*{{{*/
 {
 	nfields = dataio->nPointings();
 	x_phase_centre = new float[nfields];
@@ -30,84 +38,223 @@ CachedDataIO::CachedDataIO(DataIO* dataio, size_t max_chunks) : DataIO(), max_ch
 		y_phase_centre[fieldID] = dataio->yPhaseCentre(fieldID);
 	}
 
-	n_vis   = dataio->nvis();
 	nchan   = dataio->nChan();
 	nspw    = dataio->nSpw();
 	nstokes = dataio->nStokes();
 
-	bool chunks_left = true;
-	while(chunks_left and cache.size() < max_chunks_)
+	freq = new float[nchan*nspw];
+	for(size_t spw = 0; spw < nspw; spw++)
+	{
+		std::copy(dataio->getFreq(spw), &dataio->getFreq(spw)[nchan], 
+		          &freq[spw*nchan]);
+	}
+
+	if(max_bytes <= 0.)
+	{
+#ifdef _SC_AVPHYS_PAGES
+		max_bytes = double(sysconf(_SC_AVPHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#else
+		max_bytes = double(sysconf(_SC_PHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#endif
+		max_bytes *= CACHE_MEMORY_FRACTION;
+	}
+
+	n_vis = 0;
+	bytes = 0.;
+	max_baseline = 0.;
+	complete_ = true;
+
+	// No row has more than nchan*nstokes samples, so this is an upper
+	// bound of the size. Data that may not fit is not read at all.
+	double nrows = double(dataio->nvis());
+	double estimate = (nrows/CHUNK_SIZE+1.)*double(sizeof(Block))
+	                + nrows*double(sizeof(Row))
+	                + nrows*double(nchan*nstokes)*
+	                  double(sizeof(std::complex<float>)+sizeof(char)+sizeof(float));
+	if(estimate > max_bytes)
+	{
+		cout << "Data needs up to " << estimate/1024./1024. 
+		     << " MB, does not fit in " << max_bytes/1024./1024. 
+		     << " MB, not cached." << endl;
+		complete_ = false;
+		restart();
+		return;
+	}
+
+	Chunk chunk(CHUNK_SIZE, Chunk::layout_interleaved, false);
+	while(dataio->readChunk(chunk) > 0)
 	{
-		cache.push_back(Chunk(CHUNK_SIZE));
-		if(dataio->readChunk(*cache.rbegin()) <= 0)
+		addChunk(chunk);
+		if(bytes > max_bytes)
 		{
-			chunks_left = false;
-			cache.pop_back();
+			complete_ = false;
+			break;
 		}
 	}
 
-	cache_iterator = cache.begin();
+	cout << "Cached " << n_vis << " visibilities in " 
+	     << bytes/1024./1024. << " MB." << endl;
+	if(not complete_)
+		cout << "Data does not fit in " << max_bytes/1024./1024. 
+		     << " MB, cache is incomplete." << endl;
 
-	freq = new float[nchan*nspw];
-	for(size_t spw = 0; spw < nspw; spw++)
+	restart();
+}/*}}}*/
+
+CachedDataIO::~CachedDataIO()/*{{{*/
+{
+	for(size_t i = 0; i < cache.size(); i++)
+		delete cache[i];
+	delete[] x_phase_centre;
+	delete[] y_phase_centre;
+	delete[] freq;
+}/*}}}*/
+
+void CachedDataIO::addChunk(Chunk& chunk)/*{{{*/
+{
+	Block* b = new Block;
+
+	size_t nsamples = 0;
+	for(size_t i = 0; i < chunk.size(); i++)
+		nsamples += chunk.inVis[i].nchan*chunk.inVis[i].nstokes;
+	b->data.reserve(nsamples);
+	b->flag.reserve(nsamples);
+	b->weight.reserve(nsamples);
+	b->rows.reserve(chunk.size());
+
+	for(size_t i = 0; i < chunk.size(); i++)
 	{
-		std::copy(dataio->getFreq(spw), &dataio->getFreq(spw)[nchan], freq);
+		Visibility& vis = chunk.inVis[i];
+		int n = vis.nchan*vis.nstokes;
+
+		bool flagged = true;
+		for(int j = 0; j < n; j++)
+			flagged &= vis.data_flag[j] != 0;
+		if(flagged)
+			continue;
+
+		Row r;
+		r.u = vis.u;
+		r.v = vis.v;
+		r.w = vis.w;
+		r.fieldID = vis.fieldID;
+		r.index = vis.index;
+		r.spw = vis.spw;
+		r.antenna1 = vis.antenna1;
+		r.antenna2 = vis.antenna2;
+		r.nchan = vis.nchan;
+		r.nstokes = vis.nstokes;
+		r.offset = b->data.size();
+		b->rows.push_back(r);
+		max_baseline = std::max(max_baseline, 
+		                        double(std::max(std::abs(r.u), std::abs(r.v))));
+
+		b->data.insert(b->data.end(), vis.data, &vis.data[n]);
+		b->flag.insert(b->flag.end(), vis.data_flag, &vis.data_flag[n]);
+		b->weight.insert(b->weight.end(), vis.weight, &vis.weight[n]);
 	}
-}
+
+	if(b->rows.empty())
+	{
+		delete b;
+		return;
+	}
+
+	n_vis += b->rows.size();
+	bytes += double(sizeof(Block)) 
+	       + double(b->rows.size())*double(sizeof(Row))
+	       + double(b->data.size())*double(sizeof(std::complex<float>)
+	                                       +sizeof(char)+sizeof(float));
+	cache.push_back(b);
+}/*}}}*/
 
 size_t CachedDataIO::nvis()
 {
 	return n_vis;
 }
 
+bool CachedDataIO::complete()
+{
+	return complete_;
+}
+
+double CachedDataIO::size()
+{
+	return bytes;
+}
+
 void CachedDataIO::writeChunk(Chunk& chunk)/*{{{*/
 { 
 } /*}}}*/
 
 size_t CachedDataIO::readChunk(Chunk& chunk)/*{{{*/
 {
-	// FIXME: I have no idea what I am doing here !!!
-	if(cache_iterator == cache.end())
-		return 0;
-
+	chunk.resetSize();
 	chunk.set_dataset_id(dataset_id);
 	chunk.reshape_data(this->nchan, this->nstokes);
 
-	Chunk& chunk_internal = *cache_iterator;
-	cache_iterator++;
-
-	size_t len = chunk_internal.size()*chunk_internal.nChan()*chunk_internal.nStokes();
-
-	// Copy all data from the old to the new chunk.
-	// This copy should perhaps be done in Chunk.
-	std::copy(chunk_internal.data_real_in,
-			  &chunk_internal.data_real_in[len],
-			  chunk.data_real_in);
-	std::copy(chunk_internal.data_imag_in,
-			  &chunk_internal.data_imag_in[len],
-			  chunk.data_imag_in);
-	std::copy(chunk_internal.weight_in,
-			  &chunk_internal.weight_in[len],
-			  chunk.weight_in);
-	std::copy(chunk_internal.data_real_out,
-			  &chunk_internal.data_real_out[len],
-			  chunk.data_real_out);
-	std::copy(chunk_internal.data_imag_out,
-			  &chunk_internal.data_imag_out[len],
-			  chunk.data_imag_out);
-	std::copy(chunk_internal.weight_out,
-			  &chunk_internal.weight_out[len],
-			  chunk.weight_out);
-	std::copy(chunk_internal.inVis,
-			  &chunk_internal.inVis[chunk_internal.size()],
-			  chunk.inVis);
-	std::copy(chunk_internal.outVis,
-			  &chunk_internal.outVis[chunk_internal.size()],
-			  chunk.outVis);
-
-	chunk.update_datalinks();
-
-	return 0;
+	size_t n = 0;
+	while(n < chunk.size() and block < cache.size())
+	{
+		Block& b = *cache[block];
+		const Row& r = b.rows[row];
+		Visibility& inVis = chunk.inVis[n];
+
+		inVis.u = r.u;
+		inVis.v = r.v;
+		inVis.w = r.w;
+		inVis.fieldID = r.fieldID;
+		inVis.index = r.index;
+		inVis.spw = r.spw;
+		inVis.antenna1 = r.antenna1;
+		inVis.antenna2 = r.antenna2;
+		inVis.nchan = r.nchan;
+		inVis.nstokes = r.nstokes;
+		inVis.freq = &freq[nchan*r.spw];
+
+		int nsamples = r.nchan*r.nstokes;
+		const std::complex<float>* data = &b.data[r.offset];
+		if(chunk.get_layout() == Chunk::layout_interleaved)
+			std::copy(data, &data[nsamples], inVis.data);
+		else
+		{
+			for(int stokes = 0; stokes < r.nstokes; stokes++)
+			{
+				for(int chan = 0; chan < r.nchan; chan++)
+				{
+					inVis.data_real[r.nchan*stokes+chan] = data[chan*r.nstokes+stokes].real();
+					inVis.data_imag[r.nchan*stokes+chan] = data[chan*r.nstokes+stokes].imag();
+				}
+			}
+		}
+		std::copy(&b.flag[r.offset], &b.flag[r.offset+nsamples], inVis.data_flag);
+		std::copy(&b.weight[r.offset], &b.weight[r.offset+nsamples], inVis.weight);
+
+		Visibility& outVis = chunk.outVis[n];
+		outVis.fieldID = r.fieldID;
+		outVis.index = r.index;
+		outVis.spw = r.spw;
+		outVis.nchan = r.nchan;
+		outVis.nstokes = r.nstokes;
+		outVis.freq = inVis.freq;
+		if(chunk.has_output())
+		{
+			std::copy(inVis.weight, &inVis.weight[nsamples], outVis.weight);
+			std::copy(inVis.data_flag, &inVis.data_flag[nsamples], 
+			          outVis.data_flag);
+		}
+
+		n++;
+		row++;
+		if(row == b.rows.size())
+		{
+			block++;
+			row = 0;
+		}
+	}
+
+	chunk.setSize(n);
+	return n;
 }/*}}}*/
 
 int CachedDataIO::nPointings()
@@ -149,7 +296,13 @@ float* CachedDataIO::getFreq(int spw)
 	return &freq[spw*nchan];
 }
 
+double CachedDataIO::maxBaseline()
+{
+	return max_baseline;
+}
+
 void CachedDataIO::restart()
 {
-	cache_iterator = cache.begin();
+	block = 0;
+	row = 0;
 }
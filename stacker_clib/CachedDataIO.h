@@ -1,4 +1,5 @@
 #include <vector>
+#include <complex>
 
 #include "DataIO.h"
 #include "Chunk.h"
@@ -8,24 +9,69 @@
 
 using std::vector;
 
+// Keeps all rows of another DataIO in memory, to be read again with 
+// restart() without any I/O. Used when the same data is stacked many 
+// times, e.g. for Monte-Carlo noise estimates.
+//
+// Rows are stored with their own shape, and fully flagged rows are not 
+// stored at all since no computer reading the cache uses them. The cache
+// is read only, writeChunk does nothing.
 class CachedDataIO : public DataIO
 {
 	private:
-		size_t max_chunks_;
-		vector<Chunk> cache;
-		vector<Chunk>::iterator cache_iterator;
+		struct Row
+		{
+			float u, v, w;
+			int fieldID, index, spw;
+			int antenna1, antenna2;
+			int nchan, nstokes;
+			// Offset of the first sample in the block.
+			size_t offset;
+		};
+
+		// Rows read in one chunk from the wrapped DataIO. Data is
+		// interleaved [chan*nstokes+stokes], flags and weights
+		// [stokes*nchan+chan], as in a Chunk.
+		struct Block
+		{
+			vector<Row> rows;
+			vector<std::complex<float> > data;
+			vector<char> flag;
+			vector<float> weight;
+		};
+
+		vector<Block*> cache;
+		size_t block, row;
+		bool complete_;
+		double bytes;
+		// Largest |u| or |v| of the cached rows.
+		double max_baseline;
 
 		size_t nchan, nspw, nstokes;
-		int n_vis;
+		size_t n_vis;
 		int nfields;
 		float* x_phase_centre;
 		float* y_phase_centre;
 		float* freq;
 
+		void addChunk(Chunk& chunk);
+
 	public:
-		CachedDataIO(DataIO* dataio, size_t max_chunks);
+		// Reads all of dataio if it fits in max_bytes. The size is 
+		// estimated from nvis, nChan and nStokes first, and nothing is 
+		// read if that is larger. If max_bytes is 0 or less a fraction 
+		// of the free memory is used. dataio is not needed after this 
+		// and can be deleted.
+		CachedDataIO(DataIO* dataio, double max_bytes = 0.);
+		~CachedDataIO();
 		size_t nvis();
 
+		// False if the data did not fit in memory, the cache should then
+		// not be used.
+		bool complete();
+		// Memory used by the cache in bytes.
+		double size();
+
 		size_t readChunk(Chunk& chunk);
 		void writeChunk(Chunk& chunk);
 
@@ -38,6 +84,8 @@ class CachedDataIO : public DataIO
 		size_t nSpw();
 		size_t nStokes();
 		float* getFreq(int spw);
+		double maxBaseline();
+		// Next read starts from the first row again.
 		void restart();
 };
 
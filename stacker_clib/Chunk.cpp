@@ -22,17 +22,22 @@ Visibility::Visibility()
 {
 	data_real = NULL;
 	data_imag = NULL;
+	data = NULL;
 	data_flag = NULL;
 	weight = NULL;
 	nstokes = 0;
 	nchan = 0;
+	antenna1 = -1;
+	antenna2 = -1;
 }
 
 Visibility::~Visibility() {}
 
-Chunk::Chunk(size_t size)
+Chunk::Chunk(size_t size, int layout, bool output)
 {
 	dataset_id = dataset_none;
+	this->layout = layout;
+	this->output = output;
 	nvis = size;
 	max_nvis = size;
 
@@ -49,6 +54,8 @@ Chunk::Chunk(size_t size)
 	data_flag_out = NULL;
 	weight_in = NULL;
 	weight_out = NULL;
+	data_in = NULL;
+	data_out = NULL;
 
     update_datalinks();
 }
@@ -56,6 +63,8 @@ Chunk::Chunk(size_t size)
 Chunk::Chunk(const Chunk& c)
 {
 	dataset_id = c.dataset_id;
+	layout = c.layout;
+	output = c.output;
 	nvis = c.nvis;
 	max_nvis = c.nvis;
 
@@ -65,6 +74,17 @@ Chunk::Chunk(const Chunk& c)
 	nchan = c.nchan;
 	nstokes = c.nstokes;
 
+	data_real_in  = NULL;
+	data_real_out = NULL;
+	data_imag_in  = NULL;
+	data_imag_out = NULL;
+	data_flag_in  = NULL;
+	data_flag_out = NULL;
+	weight_in     = NULL;
+	weight_out    = NULL;
+	data_in       = NULL;
+	data_out      = NULL;
+
 	if(nchan > 0 and nstokes > 0 and nvis > 0)
 	{
 		for(int i = 0; i < nvis; i++)
@@ -79,6 +99,8 @@ Chunk::Chunk(const Chunk& c)
 			inVis[i].fieldID = c.inVis[i].fieldID;
 			inVis[i].index = c.inVis[i].index;
 			inVis[i].spw = c.inVis[i].spw;
+			inVis[i].antenna1 = c.inVis[i].antenna1;
+			inVis[i].antenna2 = c.inVis[i].antenna2;
 			inVis[i].freq = c.inVis[i].freq;
 
 			outVis[i].u = c.inVis[i].u;
@@ -92,23 +114,51 @@ Chunk::Chunk(const Chunk& c)
 			outVis[i].spw = c.inVis[i].spw;
 		}
 
-		data_real_in  = new float[nvis*nchan*nstokes];
-		data_real_out = new float[nvis*nchan*nstokes];
-		data_imag_in  = new float[nvis*nchan*nstokes];
-		data_imag_out = new float[nvis*nchan*nstokes];
+		if(layout == layout_interleaved)
+		{
+			data_in  = new std::complex<float>[nvis*nchan*nstokes];
+			if(output)
+				data_out = new std::complex<float>[nvis*nchan*nstokes];
+		}
+		else
+		{
+			data_real_in  = new float[nvis*nchan*nstokes];
+			data_imag_in  = new float[nvis*nchan*nstokes];
+			if(output)
+			{
+				data_real_out = new float[nvis*nchan*nstokes];
+				data_imag_out = new float[nvis*nchan*nstokes];
+			}
+		}
 		data_flag_in  = new int[nvis*nchan*nstokes];
-		data_flag_out = new int[nvis*nchan*nstokes];
 		weight_in     = new float[nvis*nchan*nstokes];
-		weight_out    = new float[nvis*nchan*nstokes];
+		if(output)
+		{
+			data_flag_out = new int[nvis*nchan*nstokes];
+			weight_out    = new float[nvis*nchan*nstokes];
+		}
 		for(int i = 0; i < nchan*nstokes*nvis; i++)
 		{
-			data_real_in [i] = c.data_real_in [i];
-			data_real_out[i] = c.data_real_out[i];
-			data_imag_in [i] = c.data_imag_in [i];
-			data_imag_out[i] = c.data_imag_out[i];
+			if(layout == layout_interleaved)
+				data_in [i] = c.data_in [i];
+			else
+			{
+				data_real_in [i] = c.data_real_in [i];
+				data_imag_in [i] = c.data_imag_in [i];
+			}
 			data_flag_in [i] = c.data_flag_in [i];
-			data_flag_out[i] = c.data_flag_out[i];
 			weight_in    [i] = c.weight_in    [i];
+			if(not output)
+				continue;
+
+			if(layout == layout_interleaved)
+				data_out[i] = c.data_out[i];
+			else
+			{
+				data_real_out[i] = c.data_real_out[i];
+				data_imag_out[i] = c.data_imag_out[i];
+			}
+			data_flag_out[i] = c.data_flag_out[i];
 			weight_out   [i] = c.weight_out   [i];
 		}
 	}
@@ -129,6 +179,8 @@ Chunk::~Chunk()
 	delete[] data_flag_out;
 	delete[] weight_in;
 	delete[] weight_out;
+	delete[] data_in;
+	delete[] data_out;
 	nvis = 0;
 	nchan = 0;
 	nstokes = 0;
@@ -177,6 +229,17 @@ size_t Chunk::nStokes()
 	return nstokes;
 }
 
+int Chunk::uniformStokes()
+{
+	if(nvis == 0)
+		return 0;
+	int n = inVis[0].nstokes;
+	for(size_t i = 1; i < nvis; i++)
+		if(inVis[i].nstokes != n)
+			return 0;
+	return n;
+}
+
 void Chunk::reshape_data(size_t nchan, size_t nstokes)
 {
 	// Calling this function with the same shape should be no-op.
@@ -192,6 +255,10 @@ void Chunk::reshape_data(size_t nchan, size_t nstokes)
 	delete[] data_flag_out;
 	delete[] weight_in;
 	delete[] weight_out;
+	delete[] data_in;
+	delete[] data_out;
+	data_in       = NULL;
+	data_out      = NULL;
 	data_real_in  = NULL;
 	data_real_out = NULL;
 	data_imag_in  = NULL;
@@ -203,14 +270,29 @@ void Chunk::reshape_data(size_t nchan, size_t nstokes)
 
 	if(nchan > 0 and nstokes > 0 and nvis > 0)
 	{
-		data_real_in  = new float[max_nvis*nchan*nstokes];
-		data_real_out = new float[max_nvis*nchan*nstokes];
-		data_imag_in  = new float[max_nvis*nchan*nstokes];
-		data_imag_out = new float[max_nvis*nchan*nstokes];
+		if(layout == layout_interleaved)
+		{
+			data_in  = new std::complex<float>[max_nvis*nchan*nstokes];
+			if(output)
+				data_out = new std::complex<float>[max_nvis*nchan*nstokes];
+		}
+		else
+		{
+			data_real_in  = new float[max_nvis*nchan*nstokes];
+			data_imag_in  = new float[max_nvis*nchan*nstokes];
+			if(output)
+			{
+				data_real_out = new float[max_nvis*nchan*nstokes];
+				data_imag_out = new float[max_nvis*nchan*nstokes];
+			}
+		}
 		data_flag_in  = new int[max_nvis*nchan*nstokes];
-		data_flag_out = new int[max_nvis*nchan*nstokes];
 		weight_in     = new float[max_nvis*nchan*nstokes];
-		weight_out    = new float[max_nvis*nchan*nstokes];
+		if(output)
+		{
+			data_flag_out = new int[max_nvis*nchan*nstokes];
+			weight_out    = new float[max_nvis*nchan*nstokes];
+		}
 		this->nchan  = nchan;
 		this->nstokes = nstokes;
 	}
@@ -218,6 +300,16 @@ void Chunk::reshape_data(size_t nchan, size_t nstokes)
     update_datalinks();
 }
 
+int Chunk::get_layout()
+{
+	return layout;
+}
+
+bool Chunk::has_output()
+{
+	return output;
+}
+
 int Chunk::get_dataset_id()
 {
 	return dataset_id;
@@ -236,10 +328,12 @@ void Chunk::update_datalinks()
         {
             inVis[i].data_real  = NULL;
             inVis[i].data_imag  = NULL;
+            inVis[i].data       = NULL;
             inVis[i].data_flag  = NULL;
             inVis[i].weight     = NULL;
             outVis[i].data_real = NULL;
             outVis[i].data_imag = NULL;
+            outVis[i].data      = NULL;
             outVis[i].data_flag = NULL;
             outVis[i].weight    = NULL;
         }
@@ -250,13 +344,26 @@ void Chunk::update_datalinks()
 
     for(size_t i = 0; i < nvis; i++)
     {
-        inVis[i].data_real = &data_real_in[i*nchan*nstokes];
-        inVis[i].data_imag = &data_imag_in[i*nchan*nstokes];
+        if(layout == layout_interleaved)
+            inVis[i].data      = &data_in[i*nchan*nstokes];
+        else
+        {
+            inVis[i].data_real = &data_real_in[i*nchan*nstokes];
+            inVis[i].data_imag = &data_imag_in[i*nchan*nstokes];
+        }
         inVis[i].data_flag = &data_flag_in[i*nchan*nstokes];
         inVis[i].weight    = &weight_in[i*nchan*nstokes];
 
-        outVis[i].data_real = &data_real_out[i*nchan*nstokes];
-        outVis[i].data_imag = &data_imag_out[i*nchan*nstokes];
+        if(not output)
+            continue;
+
+        if(layout == layout_interleaved)
+            outVis[i].data     = &data_out[i*nchan*nstokes];
+        else
+        {
+            outVis[i].data_real = &data_real_out[i*nchan*nstokes];
+            outVis[i].data_imag = &data_imag_out[i*nchan*nstokes];
+        }
         outVis[i].data_flag = &data_flag_out[i*nchan*nstokes];
         outVis[i].weight    = &weight_out[i*nchan*nstokes];
     }
@@ -21,6 +21,7 @@
 // #include <casa/Arrays/Matrix.h>
 // #include <casa/Arrays/Vector.h>
 #include <iostream>
+#include <complex>
 
 #ifndef __CHUNK_H__
 #define __CHUNK_H__
@@ -33,13 +34,19 @@ struct Visibility
 {
 	float u,v,w;
 	float* freq;
+	// Split layout, indexed [stokes*nchan+chan].
 	float* data_real;
 	float* data_imag;
+	// Interleaved layout, indexed [chan*nstokes+stokes] as in casacore.
+	std::complex<float>* data;
+	// Flags and weights are indexed [stokes*nchan+chan] in both layouts.
 	int*  data_flag;
 	float* weight;
 
 	int nstokes, nchan;
 	int fieldID, index, spw;
+	// Baseline, -1 if not known.
+	int antenna1, antenna2;
 
 public:
 	Visibility();
@@ -51,9 +58,18 @@ class Chunk
 public:
 	static const int dataset_none = -1;
 
+	// Layout of visibility data. The split layout keeps real and
+	// imaginary parts in separate arrays, which is what the gpu code
+	// expects. The interleaved layout has the same memory layout as a
+	// casacore Complex array, and can be read into and written from
+	// without copying.
+	static const int layout_split = 0;
+	static const int layout_interleaved = 1;
 
 private:
 	int dataset_id;
+	int layout;
+	bool output;
 	size_t nvis, max_nvis;
 	size_t nchan;
 	size_t nstokes;
@@ -67,9 +83,13 @@ public:
 	float* data_imag_out;
 	int*   data_flag_out;
 	float* weight_out;
+	std::complex<float>* data_in;
+	std::complex<float>* data_out;
 	Visibility *inVis, *outVis;
 
-	Chunk(size_t size);
+	// Chunks without output only have inVis data, outVis keeps the row
+	// metadata but its data, flag and weight pointers are NULL.
+	Chunk(size_t size, int layout = layout_split, bool output = true);
 	Chunk(const Chunk& c);
 	~Chunk();
 
@@ -79,7 +99,11 @@ public:
 
 	size_t nChan();
 	size_t nStokes();
+	// Number of stokes of the rows if all rows have the same, 0 otherwise.
+	int uniformStokes();
 	void reshape_data(size_t nchan, size_t nstokes);
+	int get_layout();
+	bool has_output();
 
 	int get_dataset_id();
 	void set_dataset_id(int id);
@@ -0,0 +1,126 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include "ChunkQueue.h"
+#include <sys/time.h>
+
+ChunkQueue::ChunkQueue()
+{
+	closed = false;
+	startTime = time();
+	lastChange = startTime;
+	sizeTime = 0.;
+	waitTime = 0.;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+ChunkQueue::~ChunkQueue()
+{
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void ChunkQueue::push(int chunkid)
+{
+	pthread_mutex_lock(&mutex);
+	updateSizeTime();
+	ids.push(chunkid);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+bool ChunkQueue::pop(int& chunkid)
+{
+	pthread_mutex_lock(&mutex);
+	if(ids.empty() && !closed)
+	{
+		double waitStart = time();
+		while(ids.empty() && !closed)
+			pthread_cond_wait(&cond, &mutex);
+		waitTime += time()-waitStart;
+	}
+
+	if(ids.empty())
+	{
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+
+	updateSizeTime();
+	chunkid = ids.front();
+	ids.pop();
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void ChunkQueue::close()
+{
+	pthread_mutex_lock(&mutex);
+	closed = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void ChunkQueue::reset()
+{
+	pthread_mutex_lock(&mutex);
+	while(!ids.empty())
+		ids.pop();
+	closed = false;
+	startTime = time();
+	lastChange = startTime;
+	sizeTime = 0.;
+	waitTime = 0.;
+	pthread_mutex_unlock(&mutex);
+}
+
+// Should be called with mutex locked, before size of queue changes.
+void ChunkQueue::updateSizeTime()
+{
+	double now = time();
+	sizeTime += double(ids.size())*(now-lastChange);
+	lastChange = now;
+}
+
+double ChunkQueue::averageSize()
+{
+	pthread_mutex_lock(&mutex);
+	updateSizeTime();
+	double elapsed = lastChange-startTime;
+	double average = 0.;
+	if(elapsed > 0.)
+		average = sizeTime/elapsed;
+	pthread_mutex_unlock(&mutex);
+	return average;
+}
+
+double ChunkQueue::totalWaitTime()
+{
+	pthread_mutex_lock(&mutex);
+	double ret = waitTime;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+double ChunkQueue::time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return double(tv.tv_sec) + 1e-6*double(tv.tv_usec);
+}
@@ -0,0 +1,75 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+/***
+ * ChunkQueue
+ *
+ * Thread-safe queue of chunk ids used to pass chunks between the threads
+ * in MSComputer. Threads waiting for a chunk sleep on a condition variable
+ * and are woken up when a chunk is pushed or when the queue is closed.
+ *
+ * Also keeps statistics on the average number of chunks in the queue and
+ * the time threads spend waiting on it, used to find pipeline bottlenecks.
+ ***/
+
+#include <queue>
+#include <pthread.h>
+
+#ifndef __CHUNK_QUEUE_H__
+#define __CHUNK_QUEUE_H__
+
+using std::queue;
+
+class ChunkQueue
+{
+	private:
+		queue<int> ids;
+		bool closed;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+
+		double startTime, lastChange;
+		double sizeTime, waitTime;
+		void updateSizeTime();
+
+	public:
+		ChunkQueue();
+		~ChunkQueue();
+
+		void push(int chunkid);
+
+		// Blocks until a chunk is available. Returns false if the queue
+		// is closed and no chunks remain.
+		bool pop(int& chunkid);
+
+		// No more chunks will be pushed, wakes up all waiting threads.
+		void close();
+
+		// Empties and reopens the queue, also resets statistics.
+		void reset();
+
+		// Time averaged number of chunks in queue since reset.
+		double averageSize();
+		// Total time spent by threads blocked in pop since reset.
+		double totalWaitTime();
+
+		// Wall clock time in seconds.
+		static double time();
+};
+
+#endif // inclusion guard
@@ -12,7 +12,7 @@ void allocate_cuda_data(DataContainer& data, /*{{{*/
     CudaSafeCall(cudaMalloc( (void**)&data.w, sizeof(float)*chunk_size));
     CudaSafeCall(cudaMalloc( (void**)&data.data_real, sizeof(float)*chunk_size*nchan*nstokes));
     CudaSafeCall(cudaMalloc( (void**)&data.data_imag, sizeof(float)*chunk_size*nchan*nstokes));
-    CudaSafeCall(cudaMalloc( (void**)&data.data_weight, sizeof(float)*chunk_size*nstokes));
+    CudaSafeCall(cudaMalloc( (void**)&data.data_weight, sizeof(float)*chunk_size*nchan*nstokes));
     CudaSafeCall(cudaMalloc( (void**)&data.data_flag, sizeof(int)*chunk_size*nchan*nstokes));
     CudaSafeCall(cudaMalloc( (void**)&data.spw, sizeof(int)*chunk_size));
     CudaSafeCall(cudaMalloc( (void**)&data.field, sizeof(int)*chunk_size));
@@ -59,7 +59,7 @@ void copy_data_to_cuda(DataContainer& data, Chunk& chunk)/*{{{*/
                 sizeof(float)*chunk.size()*chunk.nChan()*chunk.nStokes(),
                 cudaMemcpyHostToDevice));
     CudaSafeCall(cudaMemcpy(data.data_weight, chunk.weight_in,
-                sizeof(float)*chunk.size()*chunk.nStokes(),
+                sizeof(float)*chunk.size()*chunk.nChan()*chunk.nStokes(),
                 cudaMemcpyHostToDevice));
     CudaSafeCall(cudaMemcpy(data.data_flag,   chunk.data_flag_in,
                 sizeof(int)*chunk.size()*chunk.nChan()*chunk.nStokes(),
@@ -80,7 +80,7 @@ void copy_data_to_host(DataContainer& data, Chunk& chunk)/*{{{*/
                 sizeof(float)*chunk.size()*chunk.nChan()*chunk.nStokes(),
                 cudaMemcpyDeviceToHost));
     CudaSafeCall(cudaMemcpy(chunk.weight_out, data.data_weight,
-                sizeof(float)*chunk.size()*chunk.nStokes(),
+                sizeof(float)*chunk.size()*chunk.nChan()*chunk.nStokes(),
                 cudaMemcpyDeviceToHost));
     CudaSafeCall(cudaMemcpy(chunk.data_flag_out, data.data_flag,
                 sizeof(int)*chunk.size()*chunk.nChan()*chunk.nStokes(),
@@ -16,6 +16,8 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
 //
 #include "Coords.h"
+#include "FastMath.h"
+#include "FieldIndex.h"
 #ifdef CASACORE_VERSION_2
 #include <casacore/casa/Arrays/Array.h>
 #include <casacore/ms/MeasurementSets/MeasurementSet.h>
@@ -56,41 +58,27 @@ void Coords::computeCoords(DataIO* ms, PrimaryBeam& pb)
     vector<float>* cweight = new vector<float>[nPointings];
 
     nStackPoints = new int[nPointings];
-	nStackPointsVisible = 0;
-    for(int i = 0; i < nPointings; i++)
-        nStackPoints[i] = 0;
 
-	for( int i = 0; i< nStackPoints_raw; i++ )
-	{
-		bool pointVisible = false;
-		for(int fieldID = 0; fieldID < nPointings; fieldID++)
-		{
-            float dx = sin(x_raw[i]-ms->xPhaseCentre(fieldID))*cos(y_raw[i]);
-            float dy = sin(y_raw[i])*cos(ms->yPhaseCentre(fieldID))-
-				       cos(y_raw[i])*sin(ms->yPhaseCentre(fieldID))*cos(x_raw[i]-ms->xPhaseCentre(fieldID));
-//             float dx = (float(x_raw[i]) - ms->xPhaseCentre(fieldID))*cos(y_raw[i]);
-//             float dy = asin(sin(float(y_raw[i]))/cos(dx)) - ms->yPhaseCentre(fieldID);
-// 			float dx = (x - x_phase_centre[fieldID])*cos(y);
-// 			float dy = asin(sin(y)) - y_phase_centre[fieldID];
-			while(dx > 2*pi) dx -= 2*pi;
-			while(dx < -2*pi) dx += 2*pi;
-
-            if(pb.calc(dx,  dy )> 0.001)
-            {
-                cx[fieldID].push_back(float(x_raw[i]));
-                cy[fieldID].push_back(float(y_raw[i]));
-                if(weight_raw[i] <= tol)
-					cweight[fieldID].push_back(1.);
-				else
-					cweight[fieldID].push_back(float(weight_raw[i]));
-                nStackPoints[fieldID] ++;
-				pointVisible = true;
-            }
-        }
+	// Only fields near each position are tested, see FieldIndex.
+	vector<int>* visible = new vector<int>[nPointings];
+	nStackPointsVisible = findVisible(ms, pb, x_raw, y_raw, nStackPoints_raw,
+	                                  0.001, visible);
 
-		if(pointVisible)
-			nStackPointsVisible ++;
+    for(int fieldID = 0; fieldID < nPointings; fieldID++)
+    {
+        for(size_t j = 0; j < visible[fieldID].size(); j++)
+        {
+            int i = visible[fieldID][j];
+            cx[fieldID].push_back(float(x_raw[i]));
+            cy[fieldID].push_back(float(y_raw[i]));
+            if(weight_raw[i] <= tol)
+                cweight[fieldID].push_back(1.);
+            else
+                cweight[fieldID].push_back(float(weight_raw[i]));
+        }
+        nStackPoints[fieldID] = int(visible[fieldID].size());
     }
+	delete[] visible;
 
 	omega_x = new float*[nPointings];
 	omega_y = new float*[nPointings];
@@ -106,12 +94,13 @@ void Coords::computeCoords(DataIO* ms, PrimaryBeam& pb)
     {
         dx[fieldID] = new float[nStackPoints[fieldID]];
         dy[fieldID] = new float[nStackPoints[fieldID]];
-        omega_x[fieldID] = new float[nStackPoints[fieldID]];
-        omega_y[fieldID] = new float[nStackPoints[fieldID]];
-        omega_z[fieldID] = new float[nStackPoints[fieldID]];
+        // Aligned and zero padded for the vectorised kernels.
+        omega_x[fieldID] = allocAligned(nStackPoints[fieldID]);
+        omega_y[fieldID] = allocAligned(nStackPoints[fieldID]);
+        omega_z[fieldID] = allocAligned(nStackPoints[fieldID]);
         this->x[fieldID] = new float[nStackPoints[fieldID]];
         this->y[fieldID] = new float[nStackPoints[fieldID]];
-        this->weight[fieldID] = new float[nStackPoints[fieldID]];
+        this->weight[fieldID] = allocAligned(nStackPoints[fieldID]);
 
         for(int i = 0; i < nStackPoints[fieldID]; i++)
         {
@@ -216,14 +205,14 @@ Coords::~Coords()
 	{
 		for(int i = 0; i < nPointings; i++)
 		{
-			delete[] omega_x[i];
-			delete[] omega_y[i];
-			delete[] omega_z[i];
+			freeAligned(omega_x[i]);
+			freeAligned(omega_y[i]);
+			freeAligned(omega_z[i]);
 			delete[] dx[i];
 			delete[] dy[i];
 			delete[] x[i];
 			delete[] y[i];
-			delete[] weight[i];
+			freeAligned(weight[i]);
 		}
 	}
 
@@ -50,6 +50,8 @@ class fileException : public std::runtime_error {
 /* Base class for reading data from disk.
  *
  * DataIO is not thread-safe!
+ * The exception is that readChunk and writeChunk may be called at the same
+ * time from one reader thread and one writer thread.
  */
 class DataIO
 {
@@ -73,6 +75,9 @@ class DataIO
 		virtual size_t nChan() = 0;
 		virtual size_t nSpw() = 0;
 		virtual float* getFreq(int spw) = 0;
+		// Upper bound of |u| and |v| in metres of every row, 0 if it is 
+		// not known.
+		virtual double maxBaseline() { return 0.; };
 
 };
 
@@ -0,0 +1,39 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <string.h>
+#include <new>
+
+#include "FastMath.h"
+
+float* allocAligned(size_t n)
+{
+	void* p = NULL;
+	size_t bytes = paddedSize(n)*sizeof(float);
+	if(bytes == 0)
+		bytes = SIMD_ALIGN;
+	if(posix_memalign(&p, SIMD_ALIGN, bytes) != 0)
+		throw std::bad_alloc();
+	memset(p, 0, bytes);
+	return (float*)p;
+}
+
+void freeAligned(float* p)
+{
+	free(p);
+}
@@ -0,0 +1,93 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+// Helpers for the vectorised cpu kernels.
+//
+// Kernels are compiled for several instruction sets with SIMD_DISPATCH,
+// the best version for the cpu is chosen when the library is loaded.
+// Loops in the kernels are marked with "omp simd", which only needs
+// -fopenmp-simd and does not start any OpenMP threads.
+
+#include <stdlib.h>
+#include <cmath>
+
+#ifndef __FAST_MATH_H__
+#define __FAST_MATH_H__
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 && \
+    defined(__x86_64__) && defined(__linux__)
+#define SIMD_DISPATCH __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define SIMD_DISPATCH
+#endif
+
+// Alignment in bytes and width in floats of the widest vector registers.
+const size_t SIMD_ALIGN = 64;
+const size_t SIMD_WIDTH = 16;
+
+// Length of n values padded to a whole number of vectors.
+inline size_t paddedSize(size_t n)
+{
+	return (n+SIMD_WIDTH-1)/SIMD_WIDTH*SIMD_WIDTH;
+}
+
+// Aligned array of paddedSize(n) floats, all set to zero.
+// Must be released with freeAligned.
+float* allocAligned(size_t n);
+void freeAligned(float* p);
+
+// Sine and cosine of x with about float precision, for |x| < 1e9.
+//
+// Reduction to [-pi/4, pi/4] is done in double, so that phases of
+// thousands of radians keep their precision. The polynomials are the
+// ones of the cephes sinf and cosf. There are no branches, and the
+// result is returned by value, so the function can be inlined in
+// vectorised loops.
+struct SinCos
+{
+	float s, c;
+};
+
+inline SinCos fastSinCos(double x)
+{
+	const double two_over_pi = 0.636619772367581343;
+	const double pi_over_two = 1.57079632679489662;
+
+	// Rounded with an integer conversion, floor does not vectorise.
+	double t = x*two_over_pi;
+	int n = int(t + (t >= 0. ? 0.5 : -0.5));
+	float r = float(x - double(n)*pi_over_two);
+	int quadrant = n & 3;
+
+	float r2 = r*r;
+	float sin_r = r + r*r2*(-1.6666654611e-1f + r2*(8.3321608736e-3f 
+	                                           + r2*(-1.9515295891e-4f)));
+	float cos_r = 1.f - 0.5f*r2 + r2*r2*(4.166664568298827e-2f 
+	                                     + r2*(-1.388731625493765e-3f 
+	                                     + r2*2.443315711809948e-5f));
+
+	float s0 = (quadrant & 1) ? cos_r : sin_r;
+	float c0 = (quadrant & 1) ? sin_r : cos_r;
+	SinCos result;
+	result.s = (quadrant & 2) ? -s0 : s0;
+	result.c = ((quadrant+1) & 2) ? -c0 : c0;
+	return result;
+}
+
+#endif // inclusion guard
@@ -0,0 +1,253 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <cmath>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "FieldIndex.h"
+
+// Smallest grid cell, keeps cell keys within 64 bits.
+const double MIN_CELL = 1e-5;
+
+FieldIndex::FieldIndex(DataIO* ms, float radius) /*{{{*/
+{
+	nfields = ms->nPointings();
+	x_centre = new float[nfields];
+	y_centre = new float[nfields];
+	for(int fieldID = 0; fieldID < nfields; fieldID++)
+	{
+		x_centre[fieldID] = ms->xPhaseCentre(fieldID);
+		y_centre[fieldID] = ms->yPhaseCentre(fieldID);
+	}
+
+	// Beyond a radian the index would not exclude much.
+	if(radius > 1.)
+		radius = -1.;
+	this->radius = radius;
+
+	nbuckets = 1;
+	while(nbuckets < size_t(2*nfields))
+		nbuckets *= 2;
+	bucket_fields = new vector<int>[nbuckets];
+	bucket_cells = new vector<long long>[nbuckets];
+
+	cell = std::max(2.*sin(0.5*radius), MIN_CELL);
+	if(radius < 0.)
+		return;
+
+	for(int fieldID = 0; fieldID < nfields; fieldID++)
+	{
+		double ux = cos(y_centre[fieldID])*cos(x_centre[fieldID]);
+		double uy = cos(y_centre[fieldID])*sin(x_centre[fieldID]);
+		double uz = sin(y_centre[fieldID]);
+		long long key = cellKey((long long)floor((ux+1.)/cell),
+		                        (long long)floor((uy+1.)/cell),
+		                        (long long)floor((uz+1.)/cell));
+		bucket_fields[bucket(key)].push_back(fieldID);
+		bucket_cells[bucket(key)].push_back(key);
+	}
+}/*}}}*/
+
+FieldIndex::~FieldIndex()
+{
+	delete[] x_centre;
+	delete[] y_centre;
+	delete[] bucket_fields;
+	delete[] bucket_cells;
+}
+
+long long FieldIndex::cellKey(long long ix, long long iy, long long iz) const
+{
+	long long ncell = (long long)(2./cell)+3;
+	return (iz*ncell + iy)*ncell + ix;
+}
+
+size_t FieldIndex::bucket(long long key) const
+{
+	unsigned long long h = (unsigned long long)key*11400714819323198485ULL;
+	return size_t(h >> 32) & (nbuckets-1);
+}
+
+void FieldIndex::candidates(double x, double y, vector<int>& fields) const /*{{{*/
+{
+	fields.clear();
+	if(radius < 0.)
+	{
+		for(int fieldID = 0; fieldID < nfields; fieldID++)
+			fields.push_back(fieldID);
+		return;
+	}
+
+	double ux = cos(y)*cos(x);
+	double uy = cos(y)*sin(x);
+	double uz = sin(y);
+	long long ix = (long long)floor((ux+1.)/cell);
+	long long iy = (long long)floor((uy+1.)/cell);
+	long long iz = (long long)floor((uz+1.)/cell);
+	double mincos = cos(double(radius));
+
+	for(long long dz = -1; dz <= 1; dz++)
+	for(long long dy = -1; dy <= 1; dy++)
+	for(long long dx = -1; dx <= 1; dx++)
+	{
+		long long key = cellKey(ix+dx, iy+dy, iz+dz);
+		size_t b = bucket(key);
+		for(size_t i = 0; i < bucket_cells[b].size(); i++)
+		{
+			if(bucket_cells[b][i] != key)
+				continue;
+
+			int fieldID = bucket_fields[b][i];
+			double cosdist = ux*cos(y_centre[fieldID])*cos(x_centre[fieldID])
+			               + uy*cos(y_centre[fieldID])*sin(x_centre[fieldID])
+			               + uz*sin(y_centre[fieldID]);
+			if(cosdist >= mincos)
+				fields.push_back(fieldID);
+		}
+	}
+
+	std::sort(fields.begin(), fields.end());
+}/*}}}*/
+
+struct VisibleTask
+{
+	const FieldIndex* index;
+	PrimaryBeam* pb;
+	const double* x;
+	const double* y;
+	int begin, end;
+	float threshold;
+	float freq[2];
+	vector<int>* visible;
+	int nvisible;
+};
+
+void* findVisibleThread(void* data) /*{{{*/
+{
+	VisibleTask* task = (VisibleTask*)data;
+	const FieldIndex& index = *task->index;
+	vector<int> fields;
+
+	task->nvisible = 0;
+	for(int i = task->begin; i < task->end; i++)
+	{
+		bool pointVisible = false;
+		index.candidates(task->x[i], task->y[i], fields);
+
+		for(size_t j = 0; j < fields.size(); j++)
+		{
+			int fieldID = fields[j];
+			float xc = index.xCentre(fieldID);
+			float yc = index.yCentre(fieldID);
+			float dx = sin(task->x[i]-xc)*cos(task->y[i]);
+			float dy = sin(task->y[i])*cos(yc) - 
+			           cos(task->y[i])*sin(yc)*cos(task->x[i]-xc);
+
+			if(task->pb->calc(dx, dy, task->freq[0]) > task->threshold or
+			   task->pb->calc(dx, dy, task->freq[1]) > task->threshold)
+			{
+				task->visible[fieldID].push_back(i);
+				pointVisible = true;
+			}
+		}
+
+		if(pointVisible)
+			task->nvisible++;
+	}
+
+	return NULL;
+}/*}}}*/
+
+int findVisible(DataIO* ms, PrimaryBeam& pb, const double* x, const double* y, /*{{{*/
+                int n, float threshold, vector<int>* visible)
+{
+	int nfields = ms->nPointings();
+
+	// Beams are tested at both ends of the band, where they are widest 
+	// and narrowest. Without frequency information the primary beam is 
+	// called without frequency.
+	float freq[2] = {0., 0.};
+	bool first = true;
+	for(size_t spw = 0; spw < ms->nSpw(); spw++)
+	{
+		float* spwfreq = ms->getFreq(int(spw));
+		if(spwfreq == NULL)
+			continue;
+		for(size_t chan = 0; chan < ms->nChan(); chan++)
+		{
+			// Spectral windows with fewer channels are padded with zeros.
+			if(spwfreq[chan] <= tol)
+				continue;
+			if(first or spwfreq[chan] < freq[0])
+				freq[0] = spwfreq[chan];
+			if(first or spwfreq[chan] > freq[1])
+				freq[1] = spwfreq[chan];
+			first = false;
+		}
+	}
+
+	float radius0 = pb.cutoffRadius(threshold, freq[0]);
+	float radius1 = pb.cutoffRadius(threshold, freq[1]);
+	float radius = std::max(radius0, radius1);
+	if(radius0 < 0. or radius1 < 0.)
+		radius = -1.;
+	FieldIndex index(ms, radius);
+
+	int n_thread = int(sysconf(_SC_NPROCESSORS_ONLN));
+	n_thread = std::max(1, std::min(n_thread, n/1000+1));
+
+	VisibleTask* tasks = new VisibleTask[n_thread];
+	pthread_t* threads = new pthread_t[n_thread];
+	for(int t = 0; t < n_thread; t++)
+	{
+		tasks[t].index = &index;
+		tasks[t].pb = &pb;
+		tasks[t].x = x;
+		tasks[t].y = y;
+		tasks[t].begin = int((long long)n*t/n_thread);
+		tasks[t].end = int((long long)n*(t+1)/n_thread);
+		tasks[t].threshold = threshold;
+		tasks[t].freq[0] = freq[0];
+		tasks[t].freq[1] = freq[1];
+		tasks[t].visible = new vector<int>[nfields];
+		pthread_create(&threads[t], NULL, findVisibleThread, (void*)&tasks[t]);
+	}
+
+	// Threads have consecutive ranges of positions, so joining the 
+	// results in thread order keeps them sorted.
+	int nvisible = 0;
+	for(int fieldID = 0; fieldID < nfields; fieldID++)
+		visible[fieldID].clear();
+	for(int t = 0; t < n_thread; t++)
+	{
+		pthread_join(threads[t], NULL);
+		for(int fieldID = 0; fieldID < nfields; fieldID++)
+			visible[fieldID].insert(visible[fieldID].end(), 
+			                        tasks[t].visible[fieldID].begin(), 
+			                        tasks[t].visible[fieldID].end());
+		nvisible += tasks[t].nvisible;
+		delete[] tasks[t].visible;
+	}
+
+	delete[] tasks;
+	delete[] threads;
+
+	return nvisible;
+}/*}}}*/
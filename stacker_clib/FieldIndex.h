@@ -0,0 +1,71 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+#include <vector>
+
+#include "PrimaryBeam.h"
+#include "DataIO.h"
+
+#ifndef __FIELD_INDEX_H__
+#define __FIELD_INDEX_H__
+
+using std::vector;
+
+// Spatial index over the phase centres of all fields in a data set.
+//
+// Phase centres are stored as unit vectors in a hashed 3D grid with
+// cells as large as the chord of the cutoff radius, so all fields 
+// within the radius of a position are found in the 27 cells around it.
+// A negative radius means no cutoff, all fields are returned.
+class FieldIndex
+{
+	private:
+		int nfields;
+		float* x_centre;
+		float* y_centre;
+		float radius;
+		double cell;
+		size_t nbuckets;
+		vector<int>* bucket_fields;
+		vector<long long>* bucket_cells;
+
+		long long cellKey(long long ix, long long iy, long long iz) const;
+		size_t bucket(long long key) const;
+
+	public:
+		FieldIndex(DataIO* ms, float radius);
+		~FieldIndex();
+
+		float xCentre(int fieldID) const { return x_centre[fieldID]; };
+		float yCentre(int fieldID) const { return y_centre[fieldID]; };
+
+		// Sets fields to the fields that may be within the radius of
+		// (x, y), in increasing order.
+		void candidates(double x, double y, vector<int>& fields) const;
+};
+
+// Finds in which fields each of the n positions (x, y) is visible, i.e.
+// where the primary beam is above threshold at the lowest or highest
+// frequency in the data. visible[fieldID] is set to the indices of the
+// visible positions, in increasing order. Work is split over all cores.
+// Returns the number of positions visible in at least one field.
+int findVisible(DataIO* ms, PrimaryBeam& pb, const double* x, const double* y,
+                int n, float threshold, vector<int>* visible);
+
+#endif // inclusion guard
@@ -0,0 +1,470 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Gridding.h"
+#include "FastMath.h"
+
+bool isPowerOfTwo(int n)/*{{{*/
+{
+	return n > 0 and (n & (n-1)) == 0;
+}/*}}}*/
+
+int nextPowerOfTwo(int n)/*{{{*/
+{
+	int n2 = 1;
+	while(n2 < n)
+		n2 *= 2;
+	return n2;
+}/*}}}*/
+
+// Radix 2 fft of n values.
+static void fft1d(std::complex<float>* data, int n, int sign)/*{{{*/
+{
+	for(int i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+		for(; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j)
+			std::swap(data[i], data[j]);
+	}
+
+	for(int len = 2; len <= n; len <<= 1)
+	{
+		double angle = sign*2.*M_PI/len;
+		for(int k = 0; k < len/2; k++)
+		{
+			// Twiddle factors in double, the recurrence would lose
+			// precision for large grids.
+			std::complex<float> w(float(cos(angle*k)), float(sin(angle*k)));
+			for(int i = k; i < n; i += len)
+			{
+				std::complex<float> a = data[i];
+				std::complex<float> b = data[i+len/2]*w;
+				data[i] = a+b;
+				data[i+len/2] = a-b;
+			}
+		}
+	}
+}/*}}}*/
+
+void fft2d(std::complex<float>* data, int n, int sign)/*{{{*/
+{
+	for(int row = 0; row < n; row++)
+		fft1d(&data[size_t(row)*n], n, sign);
+
+	// Columns are copied to a contiguous buffer, strided access would
+	// miss the cache for every value.
+	std::vector<std::complex<float> > column(n);
+	for(int col = 0; col < n; col++)
+	{
+		for(int row = 0; row < n; row++)
+			column[row] = data[size_t(row)*n+col];
+		fft1d(&column[0], n, sign);
+		for(int row = 0; row < n; row++)
+			data[size_t(row)*n+col] = column[row];
+	}
+}/*}}}*/
+
+// Modified Bessel function of the first kind, order zero.
+static double besselI0(double x)/*{{{*/
+{
+	double sum = 1., term = 1.;
+	double y = 0.25*x*x;
+	for(int k = 1; k < 100 and term > 1e-17*sum; k++)
+	{
+		term *= y/(double(k)*k);
+		sum += term;
+	}
+	return sum;
+}/*}}}*/
+
+GridKernel::GridKernel(int width)/*{{{*/
+{
+	this->width = width;
+	double ratio = double(width)/GRID_PADDING;
+	beta = M_PI*sqrt(ratio*ratio*(GRID_PADDING-0.5)*(GRID_PADDING-0.5)-0.8);
+
+	int n = width*GRID_KERNEL_SAMPLES+1;
+	table = new float[n];
+	norm = besselI0(beta);
+	for(int i = 0; i < n; i++)
+	{
+		double t = 2.*(double(i)/GRID_KERNEL_SAMPLES-0.5*width)/width;
+		double r = 1.-t*t;
+		table[i] = r > 0. ? float(besselI0(beta*sqrt(r))/norm) : 0.f;
+	}
+
+	correctionTable = new float[GRID_KERNEL_SAMPLES+1];
+	for(int i = 0; i <= GRID_KERNEL_SAMPLES; i++)
+		correctionTable[i] = float(1./transform(0.5*i/GRID_KERNEL_SAMPLES));
+}/*}}}*/
+
+int GridKernel::widthFor(double tolerance)/*{{{*/
+{
+	// The error falls by roughly a factor of ten for every cell of 
+	// width at GRID_PADDING 2.
+	int width = int(ceil(-log10(tolerance)))+1;
+	return std::max(4, std::min(GRID_MAX_KERNEL_WIDTH, width));
+}/*}}}*/
+
+GridKernel::~GridKernel()/*{{{*/
+{
+	delete[] table;
+	delete[] correctionTable;
+}/*}}}*/
+
+double GridKernel::transform(double nu)/*{{{*/
+{
+	double a = M_PI*width*nu;
+	double r2 = beta*beta-a*a;
+	if(r2 > 0.)
+		return width*sinh(sqrt(r2))/sqrt(r2)/norm;
+	else if(r2 < 0.)
+		return width*sin(sqrt(-r2))/sqrt(-r2)/norm;
+	return width/norm;
+}/*}}}*/
+
+UVGrid::UVGrid(GridKernel* kernel, int n, double cell, /*{{{*/
+               int nw, double wLimit, int sign)
+{
+	this->kernel = kernel;
+	this->n = n;
+	this->cell = cell;
+	this->nw = nw;
+	this->sign = sign;
+	wmax = wLimit;
+	grid = new std::complex<float>[size_t(nw)*n*n];
+}/*}}}*/
+
+UVGrid::~UVGrid()/*{{{*/
+{
+	delete[] grid;
+}/*}}}*/
+
+double UVGrid::maxPixel(int n, GridKernel* kernel)/*{{{*/
+{
+	return 0.5*n/GRID_PADDING - 0.5*kernel->support();
+}/*}}}*/
+
+int UVGrid::wPlanes(double maxW, double error, double& wLimit)/*{{{*/
+{
+	if(maxW <= 0.)
+		return 1;
+
+	// Linear interpolation of exp(i*phi) between planes dw apart has an
+	// error of at most (2*pi*maxW*dw)^2/8.
+	double dw = sqrt(8.*error)/(2*M_PI*maxW);
+	int nw = std::max(2, int(ceil(2.*wLimit/dw))+1);
+	if(nw > GRID_MAX_W_PLANES)
+	{
+		nw = GRID_MAX_W_PLANES;
+		wLimit = 0.5*(nw-1)*dw;
+	}
+	return nw;
+}/*}}}*/
+
+double UVGrid::bytes(int n, int nw)/*{{{*/
+{
+	return double(nw)*n*n*sizeof(std::complex<float>);
+}/*}}}*/
+
+bool UVGrid::layout(double maxOffset, double maxW, double uvMax, /*{{{*/
+                    double error, int ngrid, double memory,
+                    GridKernel* kernel, int size, double requestedCell,
+                    int& n, double& cell, int& nw, double& wLimit, 
+                    double& used)
+{
+	// Largest cell for which the grid reaches uvMax.
+	double uvCell = uvMax > 0. ? 0.5/(GRID_PADDING*uvMax) : 0.;
+	double targetCell = requestedCell > 0. ? requestedCell : uvCell;
+
+	n = size;
+	if(n <= 0 and targetCell > 0.)
+	{
+		n = GRID_MIN_SIZE;
+		while(n < GRID_MAX_SIZE and maxPixel(n, kernel)*targetCell < maxOffset)
+			n *= 2;
+	}
+	else if(n <= 0)
+		n = GRID_DEFAULT_SIZE;
+
+	while(true)
+	{
+		if(requestedCell > 0.)
+			cell = requestedCell;
+		else if(maxOffset > 0.)
+			cell = maxOffset/maxPixel(n, kernel);
+		else if(uvCell > 0.)
+			cell = uvCell;
+		else
+			cell = 1e-7;
+
+		// Grids cover w up to twice the uv limit.
+		wLimit = 1./(GRID_PADDING*cell);
+		nw = wPlanes(maxW, error, wLimit);
+		used = ngrid*bytes(n, nw);
+		if(used <= memory or size > 0 or n <= GRID_MIN_SIZE)
+			break;
+		n /= 2;
+	}
+
+	return used <= memory and maxOffset <= maxPixel(n, kernel)*cell;
+}/*}}}*/
+
+void UVGrid::add(int npos, const float* omega_x, const float* omega_y, /*{{{*/
+                 const float* omega_z, const float* amp)
+{
+	int width = kernel->support();
+	float wx[GRID_MAX_KERNEL_WIDTH], wy[GRID_MAX_KERNEL_WIDTH];
+	size_t planeSize = size_t(n)*n;
+	for(int plane = 0; plane < nw; plane++)
+	{
+		double w = 0.;
+		if(nw > 1)
+			w = -wmax + 2.*wmax*plane/(nw-1);
+
+		// Images are stored with the phase centre at pixel 0, and 
+		// negative offsets wrapped to the end of each axis.
+		std::complex<float>* image = &grid[plane*planeSize];
+		for(int i = 0; i < npos; i++)
+		{
+			double x = double(omega_x[i])*c/(2*M_PI)/cell;
+			double y = double(omega_y[i])*c/(2*M_PI)/cell;
+			double phase = sign*double(omega_z[i])*c*w;
+			std::complex<float> a(float(amp[i]*cos(phase)), 
+			                      float(amp[i]*sin(phase)));
+
+			int x0 = int(ceil(x-0.5*width));
+			int y0 = int(ceil(y-0.5*width));
+			for(int j = 0; j < width; j++)
+			{
+				wx[j] = (*kernel)(x0+j-x);
+				wy[j] = (*kernel)(y0+j-y);
+			}
+			for(int jy = 0; jy < width; jy++)
+			{
+				std::complex<float>* row = &image[size_t((y0+jy) & (n-1))*n];
+				std::complex<float> ay = a*wy[jy];
+				for(int jx = 0; jx < width; jx++)
+					row[(x0+jx) & (n-1)] += ay*wx[jx];
+			}
+		}
+	}
+}/*}}}*/
+
+void UVGrid::finish()/*{{{*/
+{
+	// Correction for the interpolation from the grid, 1/transform of 
+	// the kernel for each pixel.
+	std::vector<float> correction(n);
+	for(int p = 0; p < n; p++)
+	{
+		int offset = p < n/2 ? p : p-n;
+		correction[p] = float(1./kernel->transform(double(offset)/n));
+	}
+
+	size_t planeSize = size_t(n)*n;
+	for(int plane = 0; plane < nw; plane++)
+	{
+		std::complex<float>* image = &grid[plane*planeSize];
+		for(int py = 0; py < n; py++)
+			for(int px = 0; px < n; px++)
+				image[size_t(py)*n+px] *= correction[px]*correction[py];
+
+		fft2d(image, n, sign);
+	}
+}/*}}}*/
+
+std::complex<float> UVGrid::operator()(double u, double v, double w)/*{{{*/
+{
+	int width = kernel->support();
+	float wu[GRID_MAX_KERNEL_WIDTH], wv[GRID_MAX_KERNEL_WIDTH];
+	int iu[GRID_MAX_KERNEL_WIDTH];
+	size_t iv[GRID_MAX_KERNEL_WIDTH];
+
+	double gu = u*n*cell;
+	double gv = v*n*cell;
+	int u0 = int(ceil(gu-0.5*width));
+	int v0 = int(ceil(gv-0.5*width));
+	for(int j = 0; j < width; j++)
+	{
+		wu[j] = (*kernel)(u0+j-gu);
+		wv[j] = (*kernel)(v0+j-gv);
+		// Negative frequencies are wrapped to the end of each axis.
+		iu[j] = (u0+j) & (n-1);
+		iv[j] = size_t((v0+j) & (n-1))*n;
+	}
+
+	int plane = 0;
+	float t = 0.;
+	if(nw > 1)
+	{
+		double pos = (w+wmax)/(2.*wmax)*(nw-1);
+		plane = std::max(0, std::min(int(pos), nw-2));
+		t = float(pos-plane);
+	}
+
+	size_t planeSize = size_t(n)*n;
+	std::complex<float> result(0., 0.);
+	for(int k = 0; k < 2; k++)
+	{
+		float planeWeight = k == 0 ? 1.f-t : t;
+		if(planeWeight == 0.)
+			continue;
+
+		const std::complex<float>* g = &grid[(plane+k)*planeSize];
+		float re = 0., im = 0.;
+		for(int jv = 0; jv < width; jv++)
+		{
+			const std::complex<float>* row = &g[iv[jv]];
+			float rowre = 0., rowim = 0.;
+			for(int ju = 0; ju < width; ju++)
+			{
+				rowre += row[iu[ju]].real()*wu[ju];
+				rowim += row[iu[ju]].imag()*wu[ju];
+			}
+			re += rowre*wv[jv];
+			im += rowim*wv[jv];
+		}
+		result += std::complex<float>(re, im)*planeWeight;
+	}
+
+	// Correction for the spreading of the sources onto the image.
+	return result*(kernel->correction(u*cell)*kernel->correction(v*cell));
+}/*}}}*/
+
+// Last channel with a frequency set in a window.
+static int lastChannel(const float* freq, int nchan)/*{{{*/
+{
+	int last = 0;
+	while(last < nchan and freq[last] > 0.)
+		last++;
+	return std::max(last-1, 0);
+}/*}}}*/
+
+int ChannelGrids::count(PrimaryBeamTable& pbtable, int fieldID, int spw, /*{{{*/
+                        int npos, const float* freq, int nchan,
+                        double tolerance)
+{
+	int last = lastChannel(freq, nchan);
+	// Rows are interpolated into these if the table does not store 
+	// every channel.
+	int stride = pbtable.stride(fieldID);
+	float* buffer = allocAligned(stride);
+	float* buffer0 = allocAligned(stride);
+	float* buffer1 = allocAligned(stride);
+	int ngrid = GRID_MAX_FREQ_GRIDS;
+
+	double maxAmp = 0.;
+	for(int chan = 0; chan <= last; chan++)
+	{
+		const float* amp = pbtable.row(fieldID, spw, chan, buffer);
+		for(int i = 0; i < npos; i++)
+			maxAmp = std::max(maxAmp, double(std::abs(amp[i])));
+	}
+
+	// No change over the window at all needs only one grid.
+	double maxDiff = 0.;
+	const float* first = pbtable.row(fieldID, spw, 0, buffer0);
+	for(int chan = 1; chan <= last; chan++)
+	{
+		const float* amp = pbtable.row(fieldID, spw, chan, buffer);
+		for(int i = 0; i < npos; i++)
+			maxDiff = std::max(maxDiff, double(std::abs(amp[i]-first[i])));
+	}
+	if(maxDiff <= tolerance*maxAmp)
+		ngrid = 1;
+
+	// Number of intervals is doubled until every channel is close enough
+	// to the interpolation between the two nearest grids.
+	for(int nint = 1; ngrid > 1 and nint < GRID_MAX_FREQ_GRIDS; nint *= 2)
+	{
+		double maxError = 0.;
+		for(int chan = 0; chan <= last; chan++)
+		{
+			int k = std::min(chan*nint/std::max(last, 1), nint-1);
+			int chan0 = k*last/nint, chan1 = (k+1)*last/nint;
+			const float* amp = pbtable.row(fieldID, spw, chan, buffer);
+			const float* amp0 = pbtable.row(fieldID, spw, chan0, buffer0);
+			const float* amp1 = pbtable.row(fieldID, spw, chan1, buffer1);
+			double t = chan1 > chan0 ? (freq[chan]-freq[chan0])/(freq[chan1]-freq[chan0]) : 0.;
+			for(int i = 0; i < npos; i++)
+			{
+				double interp = amp0[i] + t*(amp1[i]-amp0[i]);
+				maxError = std::max(maxError, std::abs(amp[i]-interp));
+			}
+		}
+
+		if(maxError <= tolerance*maxAmp)
+		{
+			ngrid = nint+1;
+			break;
+		}
+	}
+
+	freeAligned(buffer);
+	freeAligned(buffer0);
+	freeAligned(buffer1);
+	return ngrid;
+}/*}}}*/
+
+ChannelGrids::ChannelGrids(GridKernel* kernel, int n, double cell, /*{{{*/
+                           int nw, double wLimit, int sign, int ngrid,
+                           PrimaryBeamTable& pbtable, int fieldID, int spw,
+                           int npos, const float* freq, int nchan,
+                           const float* omega_x, const float* omega_y,
+                           const float* omega_z)
+{
+	this->ngrid = std::max(1, std::min(ngrid, GRID_MAX_FREQ_GRIDS));
+	last = lastChannel(freq, nchan);
+	float* buffer = allocAligned(pbtable.stride(fieldID));
+	for(int k = 0; k < this->ngrid; k++)
+	{
+		gridChan[k] = this->ngrid > 1 ? k*last/(this->ngrid-1) : last/2;
+		grids[k] = new UVGrid(kernel, n, cell, nw, wLimit, sign);
+		grids[k]->add(npos, omega_x, omega_y, omega_z, 
+		              pbtable.row(fieldID, spw, gridChan[k], buffer));
+		grids[k]->finish();
+	}
+	freeAligned(buffer);
+}/*}}}*/
+
+ChannelGrids::~ChannelGrids()/*{{{*/
+{
+	for(int k = 0; k < ngrid; k++)
+		delete grids[k];
+}/*}}}*/
+
+std::complex<float> ChannelGrids::operator()(double u, double v, double w, /*{{{*/
+                                             int chan, const float* freq)
+{
+	if(ngrid == 1)
+		return (*grids[0])(u, v, w);
+
+	int k = std::min(chan*(ngrid-1)/std::max(last, 1), ngrid-2);
+	float f0 = freq[gridChan[k]], f1 = freq[gridChan[k+1]];
+	float t = f1 != f0 ? (freq[chan]-f0)/(f1-f0) : 0.f;
+	std::complex<float> sum0 = (*grids[k])(u, v, w);
+	return sum0 + t*((*grids[k+1])(u, v, w)-sum0);
+}/*}}}*/
@@ -0,0 +1,193 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+// Helpers for gridded model prediction.
+//
+// A model is spread onto a regular image with a Kaiser-Bessel kernel,
+// Fourier transformed once, and visibilities are then interpolated from
+// the uv grid with the same kernel. Both steps are corrected with the 
+// Fourier transform of the kernel, which gives close to float precision 
+// for a padding factor of GRID_PADDING and GRID_KERNEL_WIDTH cells, see 
+// Beatty, Nishimura and Pauly (2005). The w term is handled by w 
+// stacking, grids are made for a few values of w and interpolated 
+// linearly between them.
+
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+#include "definitions.h"
+#include "PrimaryBeamTable.h"
+
+#ifndef __GRIDDING_H__
+#define __GRIDDING_H__
+
+// In place fft of a n by n array, n must be a power of two.
+// Computes sum_j data[j]*exp(sign*2*pi*i*j*k/n) along both axes.
+void fft2d(std::complex<float>* data, int n, int sign);
+
+// True if n is a power of two.
+bool isPowerOfTwo(int n);
+// Smallest power of two not less than n.
+int nextPowerOfTwo(int n);
+
+// Kaiser-Bessel kernel of width cells for GRID_PADDING.
+class GridKernel
+{
+	private:
+		int width;
+		double beta, norm;
+		float* table;
+		// 1/transform for |nu| <= 0.5 in GRID_KERNEL_SAMPLES steps.
+		float* correctionTable;
+
+	public:
+		GridKernel(int width = GRID_KERNEL_WIDTH);
+		~GridKernel();
+
+		// Smallest width for which the relative error of gridded sums is 
+		// at most tolerance.
+		static int widthFor(double tolerance);
+
+		int support() { return width; };
+
+		// Kernel at offset t cells from its centre, 0 for |t| >= width/2.
+		float operator()(double t)
+		{
+			double x = (t+0.5*width)*GRID_KERNEL_SAMPLES;
+			if(x < 0. or x >= width*GRID_KERNEL_SAMPLES)
+				return 0.;
+			int i = int(x);
+			float f = float(x-i);
+			return table[i] + f*(table[i+1]-table[i]);
+		};
+
+		// Continuous Fourier transform of the kernel at nu cycles per 
+		// cell, |nu| <= 0.5.
+		double transform(double nu);
+
+		// 1/transform(nu), interpolated from a table.
+		float correction(double nu)
+		{
+			double x = std::abs(nu)*2*GRID_KERNEL_SAMPLES;
+			int i = std::min(int(x), GRID_KERNEL_SAMPLES-1);
+			float f = float(x-i);
+			return correctionTable[i] + f*(correctionTable[i+1]-correctionTable[i]);
+		};
+};
+
+// Non-uniform fft of point sources, for a few planes in w.
+//
+// Sources are added with add(), and the grid is transformed with 
+// finish(). After that the sum over sources 
+// amp*exp(sign*2*pi*i*(u*l+v*m+w*(n-1))) can be interpolated at any
+// u, v, w in wavelengths within uvLimit() and wLimit(). Sources must be
+// within maxPixel(n, kernel)*cell of the centre along both axes.
+class UVGrid
+{
+	private:
+		GridKernel* kernel;
+		int n, nw, sign;
+		double cell, wmax;
+		std::complex<float>* grid;
+
+	public:
+		// n by n cells, a power of two, for an image with pixels of cell 
+		// radians. nw planes evenly spaced from -wLimit to wLimit.
+		UVGrid(GridKernel* kernel, int n, double cell, 
+		       int nw, double wLimit, int sign);
+		~UVGrid();
+
+		// Largest offset from the centre in pixels of a source.
+		static double maxPixel(int n, GridKernel* kernel);
+		// Number of w planes needed for sources with |n-1| up to maxW,
+		// for a relative error of error from the interpolation between
+		// planes. wLimit is reduced if more than GRID_MAX_W_PLANES are
+		// needed.
+		static int wPlanes(double maxW, double error, double& wLimit);
+		// Memory used by a grid.
+		static double bytes(int n, int nw);
+		// Chooses the size n and cell of ngrid grids, for sources up to 
+		// maxOffset from the centre along either axis in direction 
+		// cosines, with |n-1| up to maxW, and for visibilities with |u|
+		// and |v| up to uvMax wavelengths. size and requestedCell are 
+		// used if above 0. Otherwise n is the smallest power of two with
+		// cells small enough for uvMax, GRID_DEFAULT_SIZE if uvMax is 0,
+		// and cell the largest that holds the sources. n is halved until
+		// the grids fit in memory bytes, and used is set to what they 
+		// need. nw and wLimit are set as by wPlanes. Returns false if 
+		// the sources or the grids do not fit.
+		static bool layout(double maxOffset, double maxW, double uvMax,
+		                   double error, int ngrid, double memory,
+		                   GridKernel* kernel, int size, 
+		                   double requestedCell, int& n, double& cell, 
+		                   int& nw, double& wLimit, double& used);
+
+		// Adds npos sources at omega as in Coords, 2*pi*l/c, with 
+		// amplitudes amp.
+		void add(int npos, const float* omega_x, const float* omega_y,
+		         const float* omega_z, const float* amp);
+		void finish();
+
+		double uvLimit() { return 0.5/(GRID_PADDING*cell); };
+		double wLimit() { return wmax; };
+
+		std::complex<float> operator()(double u, double v, double w);
+};
+
+// Grids of the sources of one field and spectral window for a few evenly
+// spaced channels, interpolated linearly in frequency between them, so 
+// that amplitudes that follow the primary beam are kept within tolerance.
+class ChannelGrids
+{
+	private:
+		int ngrid;
+		int gridChan[GRID_MAX_FREQ_GRIDS];
+		UVGrid* grids[GRID_MAX_FREQ_GRIDS];
+		// Last channel of the window.
+		int last;
+
+	public:
+		// Number of grids needed for the npos sources of fieldID in 
+		// pbtable, for a window with nchan channels at freq. At most 
+		// GRID_MAX_FREQ_GRIDS.
+		static int count(PrimaryBeamTable& pbtable, int fieldID, int spw,
+		                 int npos, const float* freq, int nchan, 
+		                 double tolerance);
+
+		// Makes ngrid grids, from count, of n by n cells, see UVGrid, 
+		// with amplitudes from pbtable.
+		ChannelGrids(GridKernel* kernel, int n, double cell, int nw, 
+		             double wLimit, int sign, int ngrid,
+		             PrimaryBeamTable& pbtable, int fieldID, int spw, 
+		             int npos, const float* freq, int nchan, 
+		             const float* omega_x, const float* omega_y,
+		             const float* omega_z);
+		~ChannelGrids();
+
+		double uvLimit() { return grids[0]->uvLimit(); };
+		double wLimit() { return grids[0]->wLimit(); };
+
+		// Sum at u, v, w in wavelengths for channel chan of the window,
+		// freq are the frequencies of the window.
+		std::complex<float> operator()(double u, double v, double w,
+		                               int chan, const float* freq);
+};
+
+#endif // inclusion guard
@@ -20,6 +20,8 @@
 #include "MSComputer.h"
 #include "Chunk.h"
 #include <iostream>
+#include <algorithm>
+#include <unistd.h>
 #include "config.h"
 
 /*}}}*/
@@ -32,18 +34,14 @@ MSComputer::MSComputer(ChunkComputer* cc,
                        int infileoptions,
                        int outfiletype, const char* outfilename,
                        int outfileoptions,
-                       int n_thread,
+                       int n_thread, int n_chunk, int chunk_size,
 					   const bool selectField, const char* field)/*{{{*/
 {
-	n_thread_ = n_thread;
-	this->cc = cc;
-
-	pthread_mutex_init(&mutex, NULL);
+	ownData = true;
 
-	chunks = new Chunk*[N_CHUNK];
-	for( int i =0; i < N_CHUNK; i++)
-		chunks[i] = new Chunk(CHUNK_SIZE);
+	pthread_mutex_init(&statsMutex, NULL);
 
+	DataIO* input = NULL;
 	if(infiletype == FILE_TYPE_MS)
 	{
 		if(infileoptions & MS_DATACOLUMN_DATA)
@@ -51,7 +49,7 @@ MSComputer::MSComputer(ChunkComputer* cc,
 #ifdef DEBUG
 			cout << "Creating msio (data column) object." << endl;
 #endif
-			data = (DataIO*)(new msio(infilename, outfilename, msio::col_data, selectField, field, false));
+			input = (DataIO*)(new msio(infilename, outfilename, msio::col_data, selectField, field, false));
 #ifdef DEBUG
 			cout << "Created msio (data column) object." << endl;
 #endif
@@ -61,7 +59,7 @@ MSComputer::MSComputer(ChunkComputer* cc,
 #ifdef DEBUG
 			cout << "Creating msio (model column) object." << endl;
 #endif
-			data = (DataIO*)(new msio(infilename, outfilename, msio::col_model_data, selectField, field, false));
+			input = (DataIO*)(new msio(infilename, outfilename, msio::col_model_data, selectField, field, false));
 #ifdef DEBUG
 			cout << "Created msio (model column) object." << endl;
 #endif
@@ -71,14 +69,12 @@ MSComputer::MSComputer(ChunkComputer* cc,
 #ifdef DEBUG
 			cout << "Creating msio (cor. data column) object." << endl;
 #endif
-			data = (DataIO*)(new msio(infilename, outfilename, msio::col_corrected_data, selectField, field, false));
+			input = (DataIO*)(new msio(infilename, outfilename, msio::col_corrected_data, selectField, field, false));
 #ifdef DEBUB
 			cout << "Created msio (cor. data column) object." << endl;
 #endif
 		}
 	}
-	else
-		data = NULL;
 // 	if(strcmp(".ms", infile+strlen(infile)-3) == 0
 // 			||strcmp(".ms/", infile+strlen(infile)-4) == 0)
 // 	{
@@ -86,20 +82,147 @@ MSComputer::MSComputer(ChunkComputer* cc,
 // 	}
 // 	else
 // 		data = (DataIO*)(new DataIOFits(infile, outfile, &mutex));
+
+	if(input == NULL)
+	{
+		pthread_mutex_destroy(&statsMutex);
+		throw fileException(fileException::OPEN, 
+		                    "Unsupported input file type.");
+	}
+
+	setInputs(&cc, &input, 1);
+	configure(n_thread, n_chunk, chunk_size);
+}/*}}}*/
+
+MSComputer::MSComputer(ChunkComputer* cc, DataIO* data,/*{{{*/
+                       int n_thread, int n_chunk, int chunk_size,
+                       bool own_data)
+{
+	ownData = own_data;
+
+	pthread_mutex_init(&statsMutex, NULL);
+
+	setInputs(&cc, &data, 1);
+	configure(n_thread, n_chunk, chunk_size);
+}/*}}}*/
+
+MSComputer::MSComputer(ChunkComputer** cc, DataIO** data, int ninput,/*{{{*/
+                       int n_thread, int n_chunk, int chunk_size,
+                       bool own_data)
+{
+	ownData = own_data;
+
+	pthread_mutex_init(&statsMutex, NULL);
+
+	setInputs(cc, data, ninput);
+	configure(n_thread, n_chunk, chunk_size);
+}/*}}}*/
+
+void MSComputer::setInputs(ChunkComputer** cc, DataIO** data, /*{{{*/
+                           int ninput)
+{
+	this->ninput = ninput;
+	this->cc = new ChunkComputer*[ninput];
+	this->data = new DataIO*[ninput];
+	for(int i = 0; i < ninput; i++)
+	{
+		this->cc[i] = cc[i];
+		this->data[i] = data[i];
+	}
+}/*}}}*/
+
+
+void MSComputer::configure(int n_thread, int n_chunk, int chunk_size)/*{{{*/
+{
+	n_thread_ = n_thread;
+	if(n_thread_ <= 0)
+	{
+		n_thread_ = int(sysconf(_SC_NPROCESSORS_ONLN));
+		if(n_thread_ < 1)
+			n_thread_ = 1;
+	}
+
+	// Two chunks per computer thread, and one each for reader and writer.
+	n_chunk_ = n_chunk;
+	if(n_chunk_ <= 0)
+		n_chunk_ = 2*n_thread_+2;
+
+	chunk_size_ = chunk_size;
+	if(chunk_size_ <= 0)
+	{
+		size_t nchan = 1, nstokes = 1, nvis = 0;
+		for(int i = 0; i < ninput; i++)
+		{
+			if(data[i] == NULL)
+				continue;
+			nchan = std::max(data[i]->nChan(), nchan);
+			nstokes = std::max(data[i]->nStokes(), nstokes);
+			nvis += data[i]->nvis();
+		}
+
+		// Memory for one visibility in a chunk, see Chunk::reshape_data.
+		size_t vis_bytes = nchan*nstokes*(6*sizeof(float)+2*sizeof(int))
+		                 + 2*sizeof(Visibility);
+		if(not cc[0]->writesOutput())
+			vis_bytes = nchan*nstokes*(3*sizeof(float)+sizeof(int))
+			          + 2*sizeof(Visibility);
+
+		size_t size = AUTO_CHUNK_BYTES/vis_bytes;
+
+		// All chunks together should fit in a fraction of the free memory.
+#ifdef _SC_AVPHYS_PAGES
+		double memory = double(sysconf(_SC_AVPHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#else
+		double memory = double(sysconf(_SC_PHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#endif
+		if(memory > 0.)
+			size = std::min(size, size_t(AUTO_MEMORY_FRACTION*memory/vis_bytes/n_chunk_));
+
+		// Small data sets should still be split over all computer threads.
+		if(nvis > 0)
+			size = std::min(size, nvis/(2*n_thread_)+1);
+
+		chunk_size_ = int(std::max(size, (size_t)MIN_CHUNK_SIZE));
+	}
+
+	cout << "Using " << n_thread_ << " threads and " << n_chunk_ 
+	     << " chunks of " << chunk_size_ << " visibilities." << endl;
+
+	chunks = new Chunk*[n_chunk_];
+	chunkInput = new int[n_chunk_];
+	for( int i =0; i < n_chunk_; i++)
+	{
+		chunks[i] = new Chunk(chunk_size_, cc[0]->dataLayout(), 
+		                      cc[0]->writesOutput());
+		chunkInput[i] = 0;
+	}
+	for(int i = 0; i < ninput; i++)
+	{
+		cc[i]->setMaxChunkSize(chunk_size_);
+		cc[i]->setNThread(n_thread_);
+	}
 }/*}}}*/
 
 MSComputer::~MSComputer()/*{{{*/
 {
-	for( int i =0; i < N_CHUNK; i++)
+	for( int i =0; i < n_chunk_; i++)
 		delete chunks[i];
 	delete[] chunks;
+	delete[] chunkInput;
 
-	delete data;
+	for(int i = 0; ownData and i < ninput; i++)
+		delete data[i];
+	delete[] data;
+	delete[] cc;
+	pthread_mutex_destroy(&statsMutex);
 }/*}}}*/
 
 float MSComputer::run()/*{{{*/
 {
-	totalChunks = int(data->nvis()/CHUNK_SIZE)+1;
+	size_t nvis = 0;
+	for(int i = 0; i < ninput; i++)
+		nvis += data[i]->nvis();
+	totalChunks = int(nvis/chunk_size_)+1;
 	//
 	// Generate a queue of messages related to progress.
 	// Specifies how many chunks needed to print a certain progress.
@@ -111,24 +234,19 @@ float MSComputer::run()/*{{{*/
 	}
 	printQueue.push(pair<int,string>(totalChunks-1, "100%\n"));
 
-	// This variable ensures that threads are not closed
-	// if there is a temporary hickup in data read.
-	// Threads can only be terminated if all data is read,
-	// even if that means that they have to sit idle for a while.
-	// Also accessed from computer thread to find out if it is time to finish.
-	allDataRead = false;
-
 	// This counter is used for printing progress.
 	// Not important for actual calculations.
 	chunksDone = 0;
+	readTime = 0.;
+	computeTime = 0.;
+	writeTime = 0.;
 
 	// No chunks can be in use at start,
 	// cleaning up from possible earlier run.
-	while(!freeChunks.empty())
-	{
-		freeChunks.pop();
-	}
-	for( int i = 0; i < N_CHUNK; i++)
+	freeChunks.reset();
+	chunksToCompute.reset();
+	chunksToWrite.reset();
+	for( int i = 0; i < n_chunk_; i++)
 	{
 		freeChunks.push(i);
 	}
@@ -136,150 +254,205 @@ float MSComputer::run()/*{{{*/
 #ifdef DEBUG
 	cout << "Running pre compute." << endl;
 #endif
-	cc->preCompute(data);
+	for(int i = 0; i < ninput; i++)
+		cc[i]->preCompute(data[i]);
 #ifdef DEBUG
 	cout << "Creating threads." << endl;
 #endif
 
-	pthread_t threads[n_thread_];
-
-	for(int i = 0; i < n_thread_; i++)
-	{
-		pthread_create(&threads[i], NULL, startComputerThread, (void*)this);
-	}
-
 	// Actual main job.
 	// Chunks move through three queues.
-	// 1. Free chunks are picked up by main thread and put into chunksToCompute
-	// after reading data from disk into them.
+	// 1. Free chunks are picked up by the reader thread and put into
+	// chunksToCompute after reading data from disk into them.
 	// 2. chunks from chunksToCompute are picked up by computer threads
 	// and recalculated into stacked visibility before being put in chunksToWrite
-	// 3. chunks from chunksToWrite are picked up by main thread and written to disk
-	// then the chunks are put back into freeChunks
+	// 3. chunks from chunksToWrite are picked up by the writer thread and
+	// written to disk, then the chunks are put back into freeChunks
+	// If the chunk computer does not write output, computer threads put 
+	// chunks straight back into freeChunks and no writer is started.
 	//
-	// All disk read and write is done by main thread.
-
-	// Used to avoid stopping threads more than once and
-	// also ensures that main thread waits for all computer threads
-	// finish before moving on.
-	bool threadsStillRunning = true;
+	// Disk read and write are done in separate threads, so a slow write
+	// does not stall reading. Queues are bounded by the number of chunks.
+	double runStart = ChunkQueue::time();
+	pthread_t writer;
+	pthread_t readers[ninput];
+	pthread_t threads[n_thread_];
+	bool write = cc[0]->writesOutput();
+
+	// Inputs are read concurrently, each reader takes free chunks as
+	// they become available.
+	nextThread = 0;
+	nextReader = 0;
+	for(int i = 0; i < ninput; i++)
+		pthread_create(&readers[i], NULL, startReaderThread, (void*)this);
+	for(int i = 0; i < n_thread_; i++)
+	{
+		pthread_create(&threads[i], NULL, startComputerThread, (void*)this);
+	}
+	if(write)
+		pthread_create(&writer, NULL, startWriterThread, (void*)this);
 
-	while(threadsStillRunning || !chunksToWrite.empty())
+	// Each stage is shut down once the previous stage has finished.
+	for(int i = 0; i < ninput; i++)
+		pthread_join(readers[i], NULL);
+	chunksToCompute.close();
+	for(int i = 0; i < n_thread_; i++)
 	{
-		// Prints progress bar.
-		while(!printQueue.empty() && chunksDone >= printQueue.front().first)
-		{
-			cout << printQueue.front().second << std::flush;
-			printQueue.pop();
-		}
+		pthread_join(threads[i], NULL);
+	}
+	chunksToWrite.close();
+	if(write)
+		pthread_join(writer, NULL);
 
-		// Disk read and write.
-		// Lock mutex to ensure queues don't change in the middle.
-		// Would create complicated, possibly unpredictable behaviour.
-		pthread_mutex_lock(&mutex);
-		if(!allDataRead && !freeChunks.empty())
-		{
-			int chunkid = freeChunks.front();
-			freeChunks.pop();
-			pthread_mutex_unlock(&mutex);
-			// Unlock mutex while reading from disk, 
-			// chunk removed from queues ensure no one else
-			// can access it. 
-			if(data->readChunk(*chunks[chunkid]))
-			{
-				pthread_mutex_lock(&mutex);
-				chunksToCompute.push(chunkid);
-
-			}
-			else
-			{
-				pthread_mutex_lock(&mutex);
-				allDataRead = true;
-			}
-		}
-		else if(!chunksToWrite.empty())
-		{
-			int chunkid = chunksToWrite.front();
-			chunksToWrite.pop();
-			pthread_mutex_unlock(&mutex);
+	printStatistics(ChunkQueue::time()-runStart);
 
-			// Unlock mutex while writing to disk, 
-			// chunk removed from queues ensure no one else
-			// can access it.
-// 			calculate_chunk_average(*chunks[chunkid]);
-			data->writeChunk(*chunks[chunkid]);
+	for(int i = 0; i < ninput; i++)
+	{
+		cc[i]->mergeReduction();
+		cc[i]->postCompute(data[i]);
+	}
 
-			pthread_mutex_lock(&mutex);
-			freeChunks.push(chunkid);
-			chunksDone++;
-		}
-		pthread_mutex_unlock(&mutex);
 
-		// When all data is read we only need to wait for computer thread to finish
-		if(allDataRead && threadsStillRunning)
-		{
-			for(int i = 0; i < n_thread_; i++)
-			{
-				pthread_join(threads[i], NULL);
-			}
-			threadsStillRunning = false;
-		}
+	return 0.;
+}/*}}}*/
 
-		usleep(2000);
+void MSComputer::printProgress()/*{{{*/
+{
+	while(!printQueue.empty() && chunksDone >= printQueue.front().first)
+	{
+		cout << printQueue.front().second << std::flush;
+		printQueue.pop();
 	}
+}/*}}}*/
 
-	cc->postCompute(data);
+void MSComputer::printStatistics(double runTime)/*{{{*/
+{
+	if(runTime <= 0.)
+		return;
+
+	// Fraction of time each stage was busy, reader and computer threads 
+	// are averaged. The stage closest to 100% is the bottleneck.
+	cout << "Pipeline busy: read " << int(100.*readTime/runTime/ninput)
+	     << "%, compute " << int(100.*computeTime/runTime/n_thread_)
+	     << "%, write " << int(100.*writeTime/runTime) << "%" << endl;
+	cout << "Average chunks in queue (of " << n_chunk_ << "): "
+	     << "free " << freeChunks.averageSize()
+	     << ", to compute " << chunksToCompute.averageSize()
+	     << ", to write " << chunksToWrite.averageSize() << endl;
+	// Summed over all threads that pop from each queue: readers wait for
+	// free chunks, computer threads for chunks to compute, and the 
+	// writer for chunks to write.
+	cout << "Time waiting for chunks (s): free " 
+	     << freeChunks.totalWaitTime()
+	     << ", to compute " << chunksToCompute.totalWaitTime()
+	     << ", to write " << chunksToWrite.totalWaitTime() << endl;
+}/*}}}*/
 
+void* MSComputer::startReaderThread(void* computer)
+{
+	MSComputer* c = (MSComputer*)computer;
+	pthread_mutex_lock(&c->statsMutex);
+	int input = c->nextReader++;
+	pthread_mutex_unlock(&c->statsMutex);
 
-	return 0.;
-}/*}}}*/
+	c->readerThread(input);
+	return NULL;
+}
 
 void* MSComputer::startComputerThread(void* computer)
 {
-	((MSComputer*)computer)->computerThread();
+	MSComputer* c = (MSComputer*)computer;
+	pthread_mutex_lock(&c->statsMutex);
+	int thread = c->nextThread++;
+	pthread_mutex_unlock(&c->statsMutex);
+
+	c->computerThread(thread);
+	return NULL;
+}
+
+void* MSComputer::startWriterThread(void* computer)
+{
+	((MSComputer*)computer)->writerThread();
 	return NULL;
 }
 
-void MSComputer::computerThread()/*{{{*/
+void MSComputer::readerThread(int input)/*{{{*/
 {
-	while(1)
+	// Runs until all data of the input is read. Free chunks are only
+	// returned by the writer (or by computer threads when nothing is 
+	// written) so this can not block forever.
+	int chunkid;
+	double busy = 0.;
+	while(freeChunks.pop(chunkid))
 	{
-		// Any chunks to work on? Or is it time to die?
-		int chunkid = -1;
-		pthread_mutex_lock(&mutex);
-		if(!chunksToCompute.empty())
+		double start = ChunkQueue::time();
+		size_t nread = data[input]->readChunk(*chunks[chunkid]);
+		busy += ChunkQueue::time()-start;
+
+		if(nread)
 		{
-			chunkid = chunksToCompute.front();
-			chunksToCompute.pop();
+			chunkInput[chunkid] = input;
+			chunksToCompute.push(chunkid);
 		}
-		else if(allDataRead)
+		else
 		{
-			pthread_mutex_unlock(&mutex);
-			return;
+			freeChunks.push(chunkid);
+			break;
 		}
+	}
 
-		pthread_mutex_unlock(&mutex);
-
-		// Time to get to work if we found a chunk.
-		if(chunkid>=0)
-		{
-			cc->computeChunk(chunks[chunkid]);
+	pthread_mutex_lock(&statsMutex);
+	readTime += busy;
+	pthread_mutex_unlock(&statsMutex);
+}/*}}}*/
 
-			pthread_mutex_lock(&mutex);
+void MSComputer::computerThread(int thread)/*{{{*/
+{
+	// Sleeps in chunksToCompute until there is a chunk to work on,
+	// returns when the queue is closed and empty.
+	int chunkid;
+	double busy = 0.;
+	bool write = cc[0]->writesOutput();
+	while(chunksToCompute.pop(chunkid))
+	{
+		double start = ChunkQueue::time();
+		cc[chunkInput[chunkid]]->computeChunk(chunks[chunkid], thread);
+		busy += ChunkQueue::time()-start;
 
+		if(write)
 			chunksToWrite.push(chunkid);
-			pthread_mutex_unlock(&mutex);
+		else
+		{
+			freeChunks.push(chunkid);
+			pthread_mutex_lock(&statsMutex);
+			chunksDone++;
+			printProgress();
+			pthread_mutex_unlock(&statsMutex);
 		}
+	}
+
+	pthread_mutex_lock(&statsMutex);
+	computeTime += busy;
+	pthread_mutex_unlock(&statsMutex);
+}/*}}}*/
+
+void MSComputer::writerThread()/*{{{*/
+{
+	int chunkid;
+	while(chunksToWrite.pop(chunkid))
+	{
+		double start = ChunkQueue::time();
+		data[chunkInput[chunkid]]->writeChunk(*chunks[chunkid]);
+		writeTime += ChunkQueue::time()-start;
 
-		// We could be down here because we are waiting for data to be read.
-		// To be sure we don't use to much cpu while waiting lets relax a little.
-		// This delay will not matter a lot even if there is data waiting.
-		usleep(2000);
+		freeChunks.push(chunkid);
+		chunksDone++;
+		printProgress();
 	}
 }/*}}}*/
 
 DataIO* MSComputer::getMS()
 {
-	return data;
+	return data[0];
 }
 
@@ -22,6 +22,11 @@
  *
  * Runs a computer for all visbilities in a CASA measurement set. Will use
  * pthreads to use maximum number of cores. Will also handle all file io.
+ *
+ * Work is done in a three stage pipeline, one reader thread, n_thread
+ * computer threads and one writer thread, connected by chunk queues.
+ * With several inputs there is one reader thread and chunk computer per 
+ * input, sharing the chunks and computer threads.
  ***/
 
 #include <queue>
@@ -30,6 +35,9 @@
 
 #include "definitions.h"
 #include "DataIO.h"
+#include "ChunkQueue.h"
+#include "Reduction.h"
+#include "Chunk.h"
 #include "msio.h"
 // #include "DataIOFits.h"
 
@@ -45,8 +53,40 @@ class Chunk;
 
 class ChunkComputer
 {
+	protected:
+		// Largest number of visibilities in a chunk,
+		// set by MSComputer before preCompute is called.
+		size_t max_chunk_size;
+		// Number of computer threads, set by MSComputer before preCompute
+		// is called.
+		int n_thread;
+
+		// Thread local sums for computers that reduce the data to a
+		// result, set up with reduction.init(n_thread, nvalue) in 
+		// preCompute. Merged before postCompute is called.
+		ThreadReduction reduction;
+
 	public:
+		ChunkComputer() : max_chunk_size(CHUNK_SIZE), n_thread(1) {};
+		virtual ~ChunkComputer() {};
+
+		void setMaxChunkSize(size_t size) { max_chunk_size = size; };
+		void setNThread(int n) { n_thread = n; };
+		void mergeReduction() { reduction.merge(); };
+
+		// Computers that only reduce the data to a result return false,
+		// chunks are then allocated without output buffers and are 
+		// never sent to the writer.
+		virtual bool writesOutput() { return true; };
+
+		// Layout of visibility data in the chunks given to computeChunk.
+		virtual int dataLayout() { return Chunk::layout_split; };
+
 		virtual void computeChunk(Chunk* chunk) = 0;
+		// Called by computer thread number thread (0 to n_thread-1),
+		// allows results to be accumulated per thread without locking.
+		virtual void computeChunk(Chunk* chunk, int thread) 
+		{ computeChunk(chunk); };
 
 		// Called before and after actual computation.
 		// Allows full access to all data,
@@ -58,18 +98,35 @@ class MSComputer
 {
 	private:
 		int n_thread_;
-		ChunkComputer* cc;
+		int n_chunk_;
+		int chunk_size_;
 		Chunk** chunks;
 
-		DataIO* data;
-
-		bool allDataRead;
-		pthread_mutex_t mutex;
+		// Chunk computer and data for each input.
+		int ninput;
+		ChunkComputer** cc;
+		DataIO** data;
+		bool ownData;
+		// Input that each chunk was last read from.
+		int* chunkInput;
 
-		queue<int> chunksToWrite, chunksToCompute, freeChunks;
+		ChunkQueue chunksToWrite, chunksToCompute, freeChunks;
 		queue<pair<int,string> > printQueue;
 		int chunksDone, totalChunks;
 
+		// Time spent in each stage, used to report bottlenecks.
+		double readTime, computeTime, writeTime;
+		pthread_mutex_t statsMutex;
+
+		void printProgress();
+		void printStatistics(double runTime);
+		void configure(int n_thread, int n_chunk, int chunk_size);
+		void setInputs(ChunkComputer** cc, DataIO** data, int ninput);
+
+		// Computer and reader threads take their number from here when
+		// started.
+		int nextThread, nextReader;
+
 		string to_string(int x)
 		{
 			return dynamic_cast< std::ostringstream & >( \
@@ -77,16 +134,33 @@ class MSComputer
 		};
 
 	public:
+		// n_thread, n_chunk and chunk_size are chosen automatically 
+		// from hardware and data shape if set to 0 or less.
 		MSComputer(ChunkComputer* cc, 
 				   int infiletype, const char* infilename, int infileoptions,
 				   int outfiletype, const char* outfilename, int outfileoptions,
-				   int n_thread = N_THREAD, 
+				   int n_thread = N_THREAD, int n_chunk = N_CHUNK,
+				   int chunk_size = CHUNK_SIZE,
 				   const bool selectField=false, const char* field = "");
+		// Computes on an already opened data set, which is deleted with 
+		// the MSComputer if own_data is set.
+		MSComputer(ChunkComputer* cc, DataIO* data,
+				   int n_thread = N_THREAD, int n_chunk = N_CHUNK,
+				   int chunk_size = CHUNK_SIZE, bool own_data = true);
+		// Computes on ninput data sets at once, with cc[i] for data[i].
+		// The computers must share data layout and output.
+		MSComputer(ChunkComputer** cc, DataIO** data, int ninput,
+				   int n_thread = N_THREAD, int n_chunk = N_CHUNK,
+				   int chunk_size = CHUNK_SIZE, bool own_data = true);
 		~MSComputer();
 
 		float run();
+		static void* startReaderThread(void* data);
 		static void* startComputerThread(void* data);
-		void computerThread();
+		static void* startWriterThread(void* data);
+		void readerThread(int input);
+		void computerThread(int thread);
+		void writerThread();
 		DataIO* getMS();
 
 };
@@ -17,6 +17,8 @@
 //
 #include "MSPrimaryBeam.h"
 
+#include <algorithm>
+
 #ifdef CASACORE_VERSION_2
 #include <casacore/coordinates/Coordinates/CoordinateSystem.h>
 #include <casacore/images/Images/ImageOpener.h>
@@ -52,8 +54,8 @@ using casa::Quantum;
 using casa::Unit;
 using casa::uInt;
 
-MSPrimaryBeam::MSPrimaryBeam(const char fileName[]) /*{{{*/
-	: ImagePrimaryBeam(fileName)
+MSPrimaryBeam::MSPrimaryBeam(const char fileName[], int interpolation) /*{{{*/
+	: ImagePrimaryBeam(fileName, interpolation)
 {
 	ImageInterface<float>* interface = (ImageInterface<float>*)ImageOpener::openImage(fileName);
 	cs = interface->coordinates();
@@ -61,39 +63,53 @@ MSPrimaryBeam::MSPrimaryBeam(const char fileName[]) /*{{{*/
 	this->nx = shape(0);
 	this->ny = shape(1);
 
-	IPosition start(4,0);
-	IPosition dx(4,1,0,0,0);
-	IPosition dy(4,0,1,0,0);
-
-	const IPosition inputSliceShape(4,nx,1,1,1);
-	Array<float> *buff_array = new Array<float>(inputSliceShape.nonDegenerate());
-	Array<float> rowdata;
-	COWPtr<Array<float> > inputArrPtr(buff_array);
+	// Every frequency plane is used, for other axes (stokes) only the 
+	// first plane.
+	int spectral_axis = -1;
+	if(cs.hasSpectralAxis())
+		spectral_axis = cs.spectralAxisNumber();
+	if(spectral_axis >= 2 && spectral_axis < int(shape.nelements()))
+		nplanes = shape(spectral_axis);
+	else
+		nplanes = 1;
 
-	this->data = new float*[ny];
+	// The whole image is read at once, reading row by row is very slow
+	// for large images.
+	Array<float> image = interface->get();
+	bool deleteIt;
+	const float* imagedata = image.getStorage(deleteIt);
 
-	for(uInt row = 0; row < ny; row++)
+	// Distance between planes in the array, which is in fortran order.
+	size_t plane_step = 0;
+	if(nplanes > 1)
 	{
-		start(1) = row;
-		interface->getSlice(inputArrPtr, Slicer(start, inputSliceShape), true);
-		rowdata = *inputArrPtr;
-
-		data[row] = new float[nx];
+		plane_step = 1;
+		for(int axis = 0; axis < spectral_axis; axis++)
+			plane_step *= shape(axis);
+	}
 
-		for(uInt col = 0; col < nx; col++)
-		{
-			IPosition curpos = start+col*dx;
-			data[row][col] = rowdata(curpos);
-		}
+	this->data = new float[size_t(nplanes)*nx*ny];
+	for(int plane = 0; plane < nplanes; plane++)
+	{
+		std::copy(&imagedata[plane*plane_step], 
+		          &imagedata[plane*plane_step+size_t(nx)*ny], 
+		          &data[size_t(plane)*nx*ny]);
 	}
+	image.freeStorage(imagedata, deleteIt);
 
 	x0 = float(cs.referenceValue()(0));
 	y0 = float(cs.referenceValue()(1));
 
-	if(cs.hasSpectralAxis())
-		freq0 = float(cs.referenceValue()(cs.spectralAxisNumber()));
-	else
-		freq0 = float(0.);
+	plane_freq = new float[nplanes];
+	for(int plane = 0; plane < nplanes; plane++)
+	{
+		if(spectral_axis >= 0)
+			plane_freq[plane] = float(cs.referenceValue()(spectral_axis) + 
+			                          (plane-cs.referencePixel()(spectral_axis))*
+			                          cs.increment()(spectral_axis));
+		else
+			plane_freq[plane] = float(0.);
+	}
 
 	px_x0 = float(cs.referencePixel()(0));
 	px_y0 = float(cs.referencePixel()(1));
@@ -105,8 +121,4 @@ MSPrimaryBeam::MSPrimaryBeam(const char fileName[]) /*{{{*/
 
 MSPrimaryBeam::~MSPrimaryBeam()
 {
-	for(uInt row = 0; row < ny; row++)
-		delete[] data[row];
-
-	delete[] data;
 }
@@ -43,7 +43,8 @@ class MSPrimaryBeam: public ImagePrimaryBeam
 		CoordinateSystem cs;
 
 	public:
-		MSPrimaryBeam(const char fileName[]);
+		MSPrimaryBeam(const char fileName[], 
+		              int interpolation = PB_INTERP_LINEAR);
 		~MSPrimaryBeam();
 };
 
@@ -16,6 +16,10 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
 //
 #include "Model.h"
+#include "FastMath.h"
+#include "FieldIndex.h"
+
+#include <algorithm>
 
 #ifdef CASACORE_VERSION_2
 #include <casacore/casa/Arrays/Array.h>
@@ -84,6 +88,8 @@ Model::Model(string file, bool subtract)
 	y = NULL;
 	flux = NULL;
 	size = NULL;
+	model_type = NULL;
+	shapeStart = NULL;
 }
 
 Model::~Model()
@@ -92,16 +98,18 @@ Model::~Model()
 	{
 		for(int i = 0; i < nPointings; i++)
 		{
-			delete[] omega_x[i];
-			delete[] omega_y[i];
-			delete[] omega_z[i];
+			freeAligned(omega_x[i]);
+			freeAligned(omega_y[i]);
+			freeAligned(omega_z[i]);
 			delete[] omega_size[i];
 			delete[] dx[i];
 			delete[] dy[i];
 			delete[] x[i];
 			delete[] y[i];
-			delete[] flux[i];
+			freeAligned(flux[i]);
 			delete[] size[i];
+			delete[] model_type[i];
+			delete[] shapeStart[i];
 		}
 	}
 
@@ -116,6 +124,8 @@ Model::~Model()
 	delete[] y;
 	delete[] flux;
 	delete[] size;
+	delete[] model_type;
+	delete[] shapeStart;
 }
 
 void Model::compute(DataIO* ms, PrimaryBeam* pb)
@@ -137,7 +147,14 @@ void Model::compute(DataIO* ms, PrimaryBeam* pb)
 
 	double totFlux = 0.;
 
-	for(int i = 0; i < cl.nelements(); i++)
+	int ncomp = int(cl.nelements());
+	double* compx = new double[ncomp];
+	double* compy = new double[ncomp];
+	float* compflux = new float[ncomp];
+	float* compsize = new float[ncomp];
+	int* compmodel_type = new int[ncomp];
+
+	for(int i = 0; i < ncomp; i++)
 	{
 		SkyComponent sc(cl.component(i));
 		MDirection dir(sc.shape().refDirection());
@@ -162,28 +179,51 @@ void Model::compute(DataIO* ms, PrimaryBeam* pb)
 		}
 		totFlux += flux;
 
-		for(int fieldID = 0; fieldID < nPointings; fieldID++)
-		{
-// 			float dx = 1.*((x - float(ms->xPhaseCentre(fieldID)))*cos(y));
-// 			float dy = 1.*(asin(sin(y)/cos(dx)) - float(ms->yPhaseCentre(fieldID)));
-            float dx = sin(x-ms->xPhaseCentre(fieldID))*cos(y);
-            float dy = sin(y)*cos(ms->yPhaseCentre(fieldID))-
-				       cos(y)*sin(ms->yPhaseCentre(fieldID))*
-					   cos(x-ms->xPhaseCentre(fieldID));
+		compx[i] = x;
+		compy[i] = y;
+		compflux[i] = flux;
+		compsize[i] = size;
+		compmodel_type[i] = model_type;
+	}
 
+	// Only fields near each component are tested, see FieldIndex.
+	vector<int>* visible = new vector<int>[nPointings];
+	findVisible(ms, *pb, compx, compy, ncomp, 0.01, visible);
 
-			if(pb->calc(dx,  dy )> 0.01)
+	// Components are grouped by shape, so that the kernels can handle 
+	// each group without testing the shape of every component.
+	shapeStart = new int*[nPointings];
+	for(int fieldID = 0; fieldID < nPointings; fieldID++)
+	{
+		shapeStart[fieldID] = new int[mod_nshape+1];
+		for(int shape = 0; shape < mod_nshape; shape++)
+		{
+			shapeStart[fieldID][shape] = int(cx[fieldID].size());
+			for(size_t j = 0; j < visible[fieldID].size(); j++)
 			{
-				cx[fieldID].push_back(x);
-				cy[fieldID].push_back(y);
-				cflux[fieldID].push_back(flux);
-				csize[fieldID].push_back(size);
-				cmodel_type[fieldID].push_back(model_type);
-				nStackPoints[fieldID] ++;
+				int i = visible[fieldID][j];
+				int compshape = compsize[i] > 1e-10 ? compmodel_type[i] : mod_point;
+				if(compshape != shape)
+					continue;
+
+				cx[fieldID].push_back(float(compx[i]));
+				cy[fieldID].push_back(float(compy[i]));
+				cflux[fieldID].push_back(compflux[i]);
+				csize[fieldID].push_back(compsize[i]);
+				cmodel_type[fieldID].push_back(compmodel_type[i]);
 			}
 		}
+		nStackPoints[fieldID] = int(visible[fieldID].size());
+		shapeStart[fieldID][mod_nshape] = nStackPoints[fieldID];
 	}
 
+	delete[] visible;
+	delete[] compx;
+	delete[] compy;
+	delete[] compflux;
+	delete[] compsize;
+	delete[] compmodel_type;
+
 
 	x = new float*[nPointings];
 	y = new float*[nPointings];
@@ -203,11 +243,12 @@ void Model::compute(DataIO* ms, PrimaryBeam* pb)
 		y[fieldID] = new float[nStackPoints[fieldID]];
 		dx[fieldID] = new float[nStackPoints[fieldID]];
 		dy[fieldID] = new float[nStackPoints[fieldID]];
-		omega_x[fieldID] = new float[nStackPoints[fieldID]];
-		omega_y[fieldID] = new float[nStackPoints[fieldID]];
-		omega_z[fieldID] = new float[nStackPoints[fieldID]];
+		// Aligned and zero padded for the vectorised kernels.
+		omega_x[fieldID] = allocAligned(nStackPoints[fieldID]);
+		omega_y[fieldID] = allocAligned(nStackPoints[fieldID]);
+		omega_z[fieldID] = allocAligned(nStackPoints[fieldID]);
 		omega_size[fieldID] = new float[nStackPoints[fieldID]];
-		flux[fieldID] = new float[nStackPoints[fieldID]];
+		flux[fieldID] = allocAligned(nStackPoints[fieldID]);
 		size[fieldID] = new float[nStackPoints[fieldID]];
 		model_type[fieldID] = new int[nStackPoints[fieldID]];
 
@@ -248,3 +289,18 @@ void Model::compute(DataIO* ms, PrimaryBeam* pb)
     delete[] csize;
 
 }
+
+void Model::swapComponents(int fieldID, int i, int j)
+{
+	std::swap(x[fieldID][i], x[fieldID][j]);
+	std::swap(y[fieldID][i], y[fieldID][j]);
+	std::swap(dx[fieldID][i], dx[fieldID][j]);
+	std::swap(dy[fieldID][i], dy[fieldID][j]);
+	std::swap(omega_x[fieldID][i], omega_x[fieldID][j]);
+	std::swap(omega_y[fieldID][i], omega_y[fieldID][j]);
+	std::swap(omega_z[fieldID][i], omega_z[fieldID][j]);
+	std::swap(omega_size[fieldID][i], omega_size[fieldID][j]);
+	std::swap(flux[fieldID][i], flux[fieldID][j]);
+	std::swap(size[fieldID][i], size[fieldID][j]);
+	std::swap(model_type[fieldID][i], model_type[fieldID][j]);
+}
@@ -47,6 +47,7 @@ using std::endl;
 const int mod_point = 0;
 const int mod_gaussian = 1;
 const int mod_disk = 2;
+const int mod_nshape = 3;
 
 class Model
 {
@@ -58,6 +59,8 @@ public:
 	Model(string file, bool subtract);
 	~Model();
 	void compute(DataIO* ms, PrimaryBeam* pb);
+	// Swaps components i and j of a field, used to group components.
+	void swapComponents(int fieldID, int i, int j);
 
 public:
 	int nPointings;
@@ -68,6 +71,11 @@ public:
 
 	int** model_type;
 	float** omega_size;
+	// Components of each field are sorted by shape, with points (and 
+	// extended components of negligible size) first, then gaussians and 
+	// then disks. Shape s starts at shapeStart[fieldID][s] and 
+	// shapeStart[fieldID][mod_nshape] is nStackPoints[fieldID].
+	int** shapeStart;
 
 	float** dx;
 	float** dy;
@@ -0,0 +1,94 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+// Sums over model components of one shape, shared by the cpu model 
+// subtraction and Monte-Carlo stacking.
+
+#include <cmath>
+
+#include "Model.h"
+#include "PhaseRotation.h"
+
+#ifndef __MODEL_KERNELS_H__
+#define __MODEL_KERNELS_H__
+
+// Visibility of extended components relative to a point source of the 
+// same flux, for n components of one shape.
+template<int shape>
+inline void componentExtent(const float* omega_size, int n, float freq,
+                            float uv2, float uvdist, float* extent);
+
+template<>
+inline void componentExtent<mod_point>(const float* omega_size, int n, /*{{{*/
+                                       float freq, float uv2, float uvdist,
+                                       float* extent)
+{
+	for(int i = 0; i < n; i++)
+		extent[i] = 1.;
+}/*}}}*/
+
+template<>
+inline void componentExtent<mod_gaussian>(const float* omega_size, int n, /*{{{*/
+                                          float freq, float uv2, float uvdist,
+                                          float* extent)
+{
+	for(int i = 0; i < n; i++)
+		extent[i] = exp(-freq*freq*uv2*omega_size[i]);
+}/*}}}*/
+
+template<>
+inline void componentExtent<mod_disk>(const float* omega_size, int n, /*{{{*/
+                                      float freq, float uv2, float uvdist,
+                                      float* extent)
+{
+	for(int i = 0; i < n; i++)
+	{
+		float x = freq*uvdist*omega_size[i];
+		extent[i] = x > 0. ? float(2.*j1(x)/x) : 1.f;
+	}
+}/*}}}*/
+
+// Adds the model of components first to last-1 of a tile at freq. k, 
+// omega_size and amp start at the first component of the tile, extent 
+// must hold last-first values.
+template<int shape>
+inline void sumComponents(const float* k, const float* omega_size, /*{{{*/
+                          const float* amp, int first, int last, 
+                          float freq, float uv2, float uvdist,
+                          float* extent, float& re, float& im)
+{
+	if(last <= first)
+		return;
+
+	float dd_real = 0., dd_imag = 0.;
+	if(shape == mod_point)
+		sumPhasorsAtFreq(&k[first], last-first, freq, &amp[first], 
+		                 NULL, dd_real, dd_imag);
+	else
+	{
+		componentExtent<shape>(&omega_size[first], last-first, freq, 
+		                       uv2, uvdist, extent);
+		sumPhasorsAtFreq(&k[first], last-first, freq, &amp[first], 
+		                 extent, dd_real, dd_imag);
+	}
+	re += dd_real;
+	im += dd_imag;
+}/*}}}*/
+
+#endif // inclusion guard
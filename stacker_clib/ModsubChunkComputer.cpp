@@ -16,96 +16,208 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
 //
 #include <iostream>
+#include <algorithm>
 
 #include "ModsubChunkComputer.h"
 #include "Chunk.h"
 #include "PrimaryBeam.h"
+#include "PhaseRotation.h"
+#include "ModelKernels.h"
+#include "FastMath.h"
 
 
 ModsubChunkComputer::ModsubChunkComputer(Model* model, PrimaryBeam* pb)
 {
 	this->model = model;
 	this->pb = pb;
+	skipFlagged = false;
 }
 
 ModsubChunkComputer::~ModsubChunkComputer() {}
 
+void ModsubChunkComputer::setSkipFlagged(bool skip)
+{
+	skipFlagged = skip;
+}
+
+bool ModsubChunkComputer::blockFlagged(Visibility& vis, int chan0, /*{{{*/
+                                       int nchan)
+{
+	for(int i = 0; i < vis.nstokes; i++)
+		for(int j = 0; j < nchan; j++)
+			if(not vis.data_flag[vis.nchan*i+chan0+j])
+				return false;
+	return true;
+}/*}}}*/
+
 void ModsubChunkComputer::computeChunk(Chunk* chunk) /*{{{*/
+{
+	subtractDirect(chunk, NULL);
+}/*}}}*/
+
+void ModsubChunkComputer::subtractDirect(Chunk* chunk, const int* first) /*{{{*/
 {
 	for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
 	{
-		// Shorthands to make code more readable.
 		Visibility& inVis = chunk->inVis[uvrow];
 		Visibility& outVis = chunk->outVis[uvrow];
-		float &u = inVis.u;
-		float &v = inVis.v;
-		float &w = inVis.w;
 
-		int fieldID = inVis.fieldID;
+		std::copy(inVis.weight, &inVis.weight[inVis.nstokes*inVis.nchan],
+		          outVis.weight);
+		outVis.fieldID = inVis.fieldID;
+		outVis.index = inVis.index;
+	}
+
+	// Common numbers of correlations get a kernel of their own, where 
+	// the loops over correlations are unrolled.
+	switch(chunk->uniformStokes())
+	{
+		case 1:
+			subtractModel<1>(chunk, first);
+			break;
+		case 2:
+			subtractModel<2>(chunk, first);
+			break;
+		case 4:
+			subtractModel<4>(chunk, first);
+			break;
+		default:
+			subtractModel<0>(chunk, first);
+	}
+}/*}}}*/
 
-		for(int j = 0; j < inVis.nchan; j++)
+// NSTOKES is the number of correlations in every row, or 0 to use the 
+// number in each row.
+template<int NSTOKES>
+void ModsubChunkComputer::subtractModel(Chunk* chunk, const int* first) /*{{{*/
+{
+	int npos_max = 0;
+	for(int fieldID = 0; fieldID < model->nPointings; fieldID++)
+		npos_max = std::max(npos_max, model->nStackPoints[fieldID]);
+
+	int tile_max = std::min(int(paddedSize(npos_max)), POSITION_TILE);
+	float* k = allocAligned(tile_max);
+	float* extent = allocAligned(tile_max);
+	// Rows of the primary beam table, if it has to interpolate them.
+	float* pbbuffer = pbtable.interpolated() ? 
+	                  allocAligned(size_t(CHANNEL_BLOCK)*tile_max) : NULL;
+	float* model_real = new float[CHANNEL_BLOCK];
+	float* model_imag = new float[CHANNEL_BLOCK];
+
+	for(int chan0 = 0; chan0 < int(chunk->nChan()); chan0 += CHANNEL_BLOCK)
+	{
+		for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
 		{
-			for(int i = 0; i < inVis.nstokes; i++)
+			// Shorthands to make code more readable.
+			Visibility& inVis = chunk->inVis[uvrow];
+			Visibility& outVis = chunk->outVis[uvrow];
+			float &u = inVis.u;
+			float &v = inVis.v;
+			float &w = inVis.w;
+			const int nstokes = NSTOKES > 0 ? NSTOKES : inVis.nstokes;
+
+			int fieldID = inVis.fieldID;
+			int npos = model->nStackPoints[fieldID];
+			int npos_padded = int(paddedSize(npos));
+			const int* shapeStart = model->shapeStart[fieldID];
+			int firstComp = first != NULL ? first[uvrow] : 0;
+			int nchan = std::min(CHANNEL_BLOCK, inVis.nchan-chan0);
+			if(nchan <= 0)
+				continue;
+
+			// The model is subtracted from flagged data as well, unless
+			// skipFlagged is set, then blocks that are completely 
+			// flagged are copied without evaluating it.
+			if(skipFlagged and blockFlagged(inVis, chan0, nchan))
 			{
-				float dd_real = 0., dd_imag = 0.;
-				float phase;
-				float freq = float(inVis.freq[j]);
+				std::copy(&inVis.data[chan0*nstokes], 
+				          &inVis.data[(chan0+nchan)*nstokes],
+				          &outVis.data[chan0*outVis.nstokes]);
+				continue;
+			}
+
+			for(int j = 0; j < nchan; j++)
+			{
+				model_real[j] = 0.;
+				model_imag[j] = 0.;
+			}
 
-				for(int i_p = 0; i_p < model->nStackPoints[inVis.fieldID]; i_p++)
+			// The model does not depend on polarization, it is evaluated 
+			// once per channel and subtracted from every correlation.
+			float uv2 = u*u+v*v;
+			float uvdist = sqrt(uv2);
+
+			// Components are done in tiles, so that phase factors and 
+			// extents stay in cache for any number of components. Within
+			// a tile each shape is summed separately, see Model.
+			for(int p0 = firstComp/POSITION_TILE*POSITION_TILE; 
+			    firstComp < npos and p0 < npos_padded; p0 += POSITION_TILE)
+			{
+				int ntile = std::min(POSITION_TILE, npos_padded-p0);
+				int stride;
+				const float* fluxpb = pbtable.block(fieldID, inVis.spw, 
+				                                    chan0, nchan, p0, ntile,
+				                                    pbbuffer, stride);
+				phaseFactors(u, v, w, &model->omega_x[fieldID][p0], 
+				             &model->omega_y[fieldID][p0], 
+				             &model->omega_z[fieldID][p0], ntile, 1., k);
+
+				const float* omega_size = &model->omega_size[fieldID][p0];
+				int begin[mod_nshape], end[mod_nshape];
+				for(int shape = 0; shape < mod_nshape; shape++)
 				{
-					float extent = 1.;
-
-// 					d = - freq*(u*omega_x[fieldID][i_p]+v*omega_y[fieldID][i_p]);
-					phase = freq*(u*model->omega_x[inVis.fieldID][i_p]+
-					              v*model->omega_y[inVis.fieldID][i_p]+
-					              w*model->omega_z[inVis.fieldID][i_p]);
-
-					if(model->size[inVis.fieldID][i_p] > 1e-10 and
-					   model->model_type[inVis.fieldID][i_p] == mod_gaussian)
-					{
-						extent = exp(-freq*freq*(u*u + v*v)*model->omega_size[inVis.fieldID][i_p]);
-					}
-					else if(model->size[inVis.fieldID][i_p] > 1e-10 and 
-							model->model_type[inVis.fieldID][i_p] == mod_disk)
-					{
-						float uvdist = sqrt(u*u+v*v);
-						extent = 2.*j1(freq*uvdist*model->omega_size[inVis.fieldID][i_p]) /
-							          (freq*uvdist*model->omega_size[inVis.fieldID][i_p]);
-					}
-
-					float pbcor = float(pb->calc(model->dx[fieldID][i_p], 
-								                 model->dy[fieldID][i_p], 
-												 freq));
- 					dd_real += pbcor*model->flux[fieldID][i_p]*extent*cos(phase);
- 					dd_imag += pbcor*model->flux[fieldID][i_p]*extent*sin(phase);
+					begin[shape] = std::max(std::max(shapeStart[shape], firstComp)-p0, 0);
+					end[shape] = std::min(shapeStart[shape+1]-p0, ntile);
+				}
+				// Padding has zero flux, including it lets the point 
+				// kernel run on whole vectors.
+				if(shapeStart[mod_point+1] == npos)
+					end[mod_point] = ntile;
 
+				for(int j = 0; j < nchan; j++)
+				{
+					int chan = chan0+j;
+					float freq = float(inVis.freq[chan]);
+
+					const float* amp = &fluxpb[j*stride];
+					sumComponents<mod_point>(k, omega_size, amp, 
+					        begin[mod_point], end[mod_point], 
+					        freq, uv2, uvdist, extent, 
+					        model_real[j], model_imag[j]);
+					sumComponents<mod_gaussian>(k, omega_size, amp, 
+					        begin[mod_gaussian], end[mod_gaussian], 
+					        freq, uv2, uvdist, extent, 
+					        model_real[j], model_imag[j]);
+					sumComponents<mod_disk>(k, omega_size, amp, 
+					        begin[mod_disk], end[mod_disk], 
+					        freq, uv2, uvdist, extent, 
+					        model_real[j], model_imag[j]);
 				}
+			}
 
-				outVis.data_real[i*outVis.nchan+j] = inVis.data_real[i*inVis.nchan+j] - dd_real;
-				outVis.data_imag[i*outVis.nchan+j] = inVis.data_imag[i*inVis.nchan+j] - dd_imag;
+			for(int j = 0; j < nchan; j++)
+			{
+				int chan = chan0+j;
+				std::complex<float> model_vis(model_real[j], model_imag[j]);
+				for(int i = 0; i < nstokes; i++)
+					outVis.data[chan*nstokes+i] = inVis.data[chan*nstokes+i]
+					                            - model_vis;
 			}
 		}
-
-		for(int i = 0; i < inVis.nstokes; i++)
-			outVis.weight[i] = inVis.weight[i];
-		outVis.fieldID = inVis.fieldID;
-		outVis.index = inVis.index;
-
-//  		msc_out.data().put(uvrow, (casa::Array<Complex>)data);
-//  		msc_out.weight().put(uvrow, (casa::Array<Float>)visWeight);
-//  		msc_out.fieldId().put(uvrow, 0);
-		
-// 		msc_out.correctedData().put(i, (casa::Array<Complex>)data);
-
-// 		it->next();
-// 		visWeightit->next();
-// 		datait->next();
 	}
+
+	freeAligned(k);
+	freeAligned(extent);
+	freeAligned(pbbuffer);
+	delete[] model_real;
+	delete[] model_imag;
 }/*}}}*/
 
 void ModsubChunkComputer::preCompute(DataIO* ms)
 {
 	model->compute(ms, pb);
+	pbtable.compute(ms, *pb, model->nPointings, model->nStackPoints,
+	                model->dx, model->dy, model->flux);
 }
 
 void ModsubChunkComputer::postCompute(DataIO* ms)
@@ -20,6 +20,7 @@
 #include "MSComputer.h"
 #include "Model.h"
 #include "PrimaryBeam.h"
+#include "PrimaryBeamTable.h"
 #include "DataIO.h"
 
 #ifndef __MODSUB_CHUNK_COMPUTER_H__
@@ -28,19 +29,41 @@
 class ModsubChunkComputer: public ChunkComputer
 {
 	private:
+		template<int NSTOKES>
+		void subtractModel(Chunk* chunk, const int* first);
+
+	protected:
 		Model* model;
 		PrimaryBeam* pb;
+		PrimaryBeamTable pbtable;
+		bool skipFlagged;
+
+		// True if every correlation of channels chan0 to chan0+nchan-1
+		// of vis is flagged.
+		bool blockFlagged(Visibility& vis, int chan0, int nchan);
+
+		// Writes input minus the model to the output of the chunk. Only 
+		// components from first[uvrow] on are subtracted from each row,
+		// or all components if first is NULL.
+		void subtractDirect(Chunk* chunk, const int* first);
 
 	public:
 		ModsubChunkComputer(Model* model, PrimaryBeam* pb);
 		~ModsubChunkComputer();
 
+		// Copy blocks of CHANNEL_BLOCK channels that are completely 
+		// flagged to the output without subtracting the model. By default
+		// the model is subtracted from all data, flagged or not.
+		void setSkipFlagged(bool skip);
+
 		// Called from computer and allows to access data,
 		// unlike normal constructor which is called before computer
 		// is created.
 		void preCompute(DataIO* ms);
 		virtual void computeChunk(Chunk* chunk);
 		void postCompute(DataIO* ms);
+
+		int dataLayout() { return Chunk::layout_interleaved; };
 };
 
 #endif // inclusion guard
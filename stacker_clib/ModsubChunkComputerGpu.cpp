@@ -35,20 +35,22 @@ ModsubChunkComputerGpu::ModsubChunkComputerGpu(Model* model, PrimaryBeam* pb)/*{
 void ModsubChunkComputerGpu::computeChunk(Chunk* chunk) /*{{{*/
 {
 	copy_data_to_cuda(dev_data, *chunk);
-	if((size_t)model->nStackPoints[chunk->inVis[0].fieldID] > N_MAX_MOD_COMP)
+	// Models that fit in one tile stay on the device until the field 
+	// changes, larger models are copied one tile at a time.
+	if((size_t)model->nStackPoints[chunk->inVis[0].fieldID] > MOD_COMP_TILE)
 	{
 		size_t first_mod_comp = 0;
 		field = chunk->inVis[0].fieldID;
 
 		while(first_mod_comp < (size_t)model->nStackPoints[field])
 		{
-			size_t n_mod_comp = std::min(N_MAX_MOD_COMP, 
+			size_t n_mod_comp = std::min(MOD_COMP_TILE, 
 					(size_t)model->nStackPoints[field] - first_mod_comp);
 
 			copy_model_to_cuda_partial(*model, dev_model, freq, *pb, field, chunk->nChan(), nspw, n_mod_comp, first_mod_comp);
 			modsub_chunk(dev_data, dev_model, chunk->size(),
 					chunk->nChan(), chunk->nStokes());
-			first_mod_comp += N_MAX_MOD_COMP;
+			first_mod_comp += MOD_COMP_TILE;
 		}
 	}
 	else
@@ -56,7 +58,9 @@ void ModsubChunkComputerGpu::computeChunk(Chunk* chunk) /*{{{*/
 		if(chunk->inVis[0].fieldID != field)
 		{
 			field = chunk->inVis[0].fieldID;
-			copy_model_to_cuda(*model, dev_model, freq, *pb, field, chunk->nChan(), nspw);
+			copy_model_to_cuda_partial(*model, dev_model, freq, *pb, field, 
+			                           chunk->nChan(), nspw, 
+			                           model->nStackPoints[field], 0);
 		}
 		modsub_chunk(dev_data, dev_model, chunk->size(),
 				chunk->nChan(), chunk->nStokes());
@@ -74,9 +78,10 @@ void ModsubChunkComputerGpu::preCompute(DataIO* dataio)/*{{{*/
 			nmax_model_comp = model->nStackPoints[i];
 		}
 
-	allocate_cuda_data(dev_data, dataio->nChan(), dataio->nStokes(), CHUNK_SIZE);
+	allocate_cuda_data(dev_data, dataio->nChan(), dataio->nStokes(), max_chunk_size);
 	allocate_cuda_data_modsub(dev_model, dataio->nChan(),
-					          nmax_model_comp, dataio->nSpw());
+					          std::min(size_t(nmax_model_comp), MOD_COMP_TILE), 
+					          dataio->nSpw());
 
 	nspw = dataio->nSpw();
     freq = new float[dataio->nChan()*dataio->nSpw()];
@@ -32,10 +32,8 @@ typedef struct _ModelContainer
 
 void allocate_cuda_data_modsub(ModelContainer& dev_model, const size_t nchan, 
                                const size_t nmax_mod_comp, const size_t nspw);
-void copy_model_to_cuda(Model& model, ModelContainer& dev_model, 
-                         float* freq, PrimaryBeam& pb, 
-                         const int field, const size_t nchan,
-                         const size_t nspw);
+// Copies components first_mod_comp to first_mod_comp+n_mod_comp of field,
+// at most MOD_COMP_TILE.
 void copy_model_to_cuda_partial(Model& model, ModelContainer& dev_model, 
                          float* freq, PrimaryBeam& pb, 
                          const int field, const size_t nchan,
@@ -0,0 +1,283 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+#include "ModsubGridChunkComputer.h"
+#include "definitions.h"
+
+using std::cout;
+using std::endl;
+
+ModsubGridChunkComputer::ModsubGridChunkComputer(Model* model, /*{{{*/
+                                                 PrimaryBeam* pb,
+                                                 double cell, int size)
+	: ModsubChunkComputer(model, pb)
+{
+	requestedCell = cell;
+	requestedSize = std::max(size, 0);
+	if(requestedSize > 0 and not isPowerOfTwo(requestedSize))
+	{
+		cout << "Grid size " << requestedSize << " is not a power of two, "
+		     << "using " << nextPowerOfTwo(requestedSize) << "." << endl;
+		requestedSize = nextPowerOfTwo(requestedSize);
+	}
+
+	nfields = 0;
+	nspw = 0;
+	spwMaxFreq = NULL;
+	nGridded = NULL;
+	grids = NULL;
+	rowsGridded = 0;
+	rowsDirect = 0;
+	pthread_mutex_init(&countMutex, NULL);
+}/*}}}*/
+
+ModsubGridChunkComputer::~ModsubGridChunkComputer()/*{{{*/
+{
+	freeGrids();
+	pthread_mutex_destroy(&countMutex);
+}/*}}}*/
+
+void ModsubGridChunkComputer::freeGrids()/*{{{*/
+{
+	for(int i = 0; grids != NULL and i < nfields*nspw; i++)
+		delete grids[i];
+	delete[] grids;
+	delete[] spwMaxFreq;
+	delete[] nGridded;
+	grids = NULL;
+	spwMaxFreq = NULL;
+	nGridded = NULL;
+	nfields = 0;
+	nspw = 0;
+}/*}}}*/
+
+void ModsubGridChunkComputer::preCompute(DataIO* ms)/*{{{*/
+{
+	freeGrids();
+	model->compute(ms, pb);
+	rowsGridded = 0;
+	rowsDirect = 0;
+
+	nfields = model->nPointings;
+	nspw = int(ms->nSpw());
+	int nchan = int(ms->nChan());
+
+	spwMaxFreq = new float[nspw];
+	float maxFreq = 0.;
+	for(int spw = 0; spw < nspw; spw++)
+	{
+		float* freq = ms->getFreq(spw);
+		spwMaxFreq[spw] = *std::max_element(freq, &freq[nchan]);
+		maxFreq = std::max(maxFreq, spwMaxFreq[spw]);
+	}
+
+	// Grids are made large enough for the longest baseline if memory
+	// allows.
+	double uvMax = ms->maxBaseline()*maxFreq/c;
+	if(uvMax <= 0. and requestedSize <= 0)
+		cout << "uv coverage of the data is not known, using grids of up to "
+		     << GRID_DEFAULT_SIZE << " cells." << endl;
+
+	nGridded = new int[nfields];
+	grids = new ChannelGrids*[nfields*nspw];
+	for(int i = 0; i < nfields*nspw; i++)
+		grids[i] = NULL;
+
+#ifdef _SC_AVPHYS_PAGES
+	double memory = double(sysconf(_SC_AVPHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#else
+	double memory = double(sysconf(_SC_PHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#endif
+	memory *= GRID_MEMORY_FRACTION;
+
+	double* maxOffset = new double[nfields];
+	int totalComponents = 0;
+	for(int fieldID = 0; fieldID < nfields; fieldID++)
+	{
+		totalComponents += model->nStackPoints[fieldID];
+		selectComponents(fieldID, maxOffset[fieldID]);
+		if(nGridded[fieldID] < GRID_MIN_COMPONENTS)
+			nGridded[fieldID] = 0;
+	}
+
+	// The number of grids per window follows from how much the primary 
+	// beam changes over it, so the grid sizes wait for the table.
+	pbtable.compute(ms, *pb, model->nPointings, model->nStackPoints,
+	                model->dx, model->dy, model->flux);
+
+	int totalGridded = 0, fieldsGridded = 0, largest = 0;
+	double used = 0.;
+	int* ngrid = new int[nspw];
+	for(int fieldID = 0; fieldID < nfields; fieldID++)
+	{
+		if(nGridded[fieldID] == 0)
+			continue;
+
+		int ngridTotal = 0;
+		for(int spw = 0; spw < nspw; spw++)
+		{
+			ngrid[spw] = ChannelGrids::count(pbtable, fieldID, spw, 
+			                                 nGridded[fieldID], 
+			                                 ms->getFreq(spw), nchan,
+			                                 GRID_TOLERANCE);
+			ngridTotal += ngrid[spw];
+		}
+
+		double maxW = 0.;
+		for(int i = 0; i < nGridded[fieldID]; i++)
+			maxW = std::max(maxW, std::abs(double(model->omega_z[fieldID][i])*c/(2*M_PI)));
+
+		int n, nw;
+		double cell, wLimit, bytes;
+		if(not UVGrid::layout(maxOffset[fieldID], maxW, uvMax, 
+		                      GRID_TOLERANCE, ngridTotal, memory-used, 
+		                      &kernel, requestedSize, requestedCell,
+		                      n, cell, nw, wLimit, bytes))
+		{
+			cout << "Grids for field " << fieldID << " do not fit in memory, "
+			     << "using direct sum." << endl;
+			nGridded[fieldID] = 0;
+			continue;
+		}
+		used += bytes;
+		totalGridded += nGridded[fieldID];
+		fieldsGridded++;
+		largest = std::max(largest, n);
+
+		for(int spw = 0; spw < nspw; spw++)
+			grids[fieldID*nspw+spw] = new ChannelGrids(&kernel, n, cell, nw,
+			        wLimit, 1, ngrid[spw], pbtable, fieldID, spw, 
+			        nGridded[fieldID], ms->getFreq(spw), nchan, 
+			        model->omega_x[fieldID], model->omega_y[fieldID], 
+			        model->omega_z[fieldID]);
+	}
+
+	delete[] ngrid;
+	delete[] maxOffset;
+
+	cout << "Gridded " << totalGridded << " of " << totalComponents 
+	     << " components in " << fieldsGridded << " fields on grids of up to "
+	     << largest << " cells, using " << used/1024./1024. << " MB." 
+	     << endl;
+}/*}}}*/
+
+// Moves point components that fit in the image first in the model, and
+// sets nGridded. maxOffset is the largest offset of these from the 
+// phase centre in direction cosines.
+void ModsubGridChunkComputer::selectComponents(int fieldID, /*{{{*/
+                                               double& maxOffset)
+{
+	// With a given cell only components that fit in the largest grid 
+	// are gridded.
+	int n = requestedSize > 0 ? requestedSize : GRID_MAX_SIZE;
+	double maxPixel = UVGrid::maxPixel(n, &kernel);
+	double limit = requestedCell > 0. ? maxPixel*requestedCell : 1.;
+
+	int ngridded = 0;
+	maxOffset = 0.;
+	for(int i = 0; i < model->shapeStart[fieldID][mod_point+1]; i++)
+	{
+		double l = double(model->omega_x[fieldID][i])*c/(2*M_PI);
+		double m = double(model->omega_y[fieldID][i])*c/(2*M_PI);
+		double offset = std::max(std::abs(l), std::abs(m));
+		if(offset > limit)
+			continue;
+
+		model->swapComponents(fieldID, i, ngridded);
+		ngridded++;
+		maxOffset = std::max(maxOffset, offset);
+	}
+	nGridded[fieldID] = ngridded;
+}/*}}}*/
+
+// True if the gridded components of the row can be taken from the grid.
+bool ModsubGridChunkComputer::gridded(Visibility& vis)/*{{{*/
+{
+	ChannelGrids* grid = grids[vis.fieldID*nspw+vis.spw];
+	if(nGridded[vis.fieldID] == 0 or grid == NULL)
+		return false;
+
+	double scale = spwMaxFreq[vis.spw]/c;
+	return std::abs(vis.u*scale) <= grid->uvLimit() and 
+	       std::abs(vis.v*scale) <= grid->uvLimit() and
+	       std::abs(vis.w*scale) <= grid->wLimit();
+}/*}}}*/
+
+void ModsubGridChunkComputer::computeChunk(Chunk* chunk)/*{{{*/
+{
+	// Components that are not gridded are subtracted with the direct sum,
+	// all components for rows outside the grid.
+	int* first = new int[chunk->size()];
+	size_t ngridded = 0;
+	for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
+	{
+		Visibility& inVis = chunk->inVis[uvrow];
+		first[uvrow] = gridded(inVis) ? nGridded[inVis.fieldID] : 0;
+		if(first[uvrow] > 0)
+			ngridded++;
+	}
+
+	pthread_mutex_lock(&countMutex);
+	rowsGridded += ngridded;
+	rowsDirect += chunk->size()-ngridded;
+	pthread_mutex_unlock(&countMutex);
+
+	subtractDirect(chunk, first);
+
+	for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
+	{
+		if(first[uvrow] == 0)
+			continue;
+
+		Visibility& inVis = chunk->inVis[uvrow];
+		Visibility& outVis = chunk->outVis[uvrow];
+		ChannelGrids* grid = grids[inVis.fieldID*nspw+inVis.spw];
+		for(int chan0 = 0; chan0 < inVis.nchan; chan0 += CHANNEL_BLOCK)
+		{
+			// Same blocks as in subtractDirect.
+			int nchan = std::min(CHANNEL_BLOCK, inVis.nchan-chan0);
+			if(skipFlagged and blockFlagged(inVis, chan0, nchan))
+				continue;
+
+			for(int chan = chan0; chan < chan0+nchan; chan++)
+			{
+				double scale = inVis.freq[chan]/c;
+				std::complex<float> model_vis = (*grid)(inVis.u*scale, 
+				                                        inVis.v*scale,
+				                                        inVis.w*scale, chan,
+				                                        inVis.freq);
+				for(int i = 0; i < inVis.nstokes; i++)
+					outVis.data[chan*inVis.nstokes+i] -= model_vis;
+			}
+		}
+	}
+
+	delete[] first;
+}/*}}}*/
+
+void ModsubGridChunkComputer::postCompute(DataIO* ms)/*{{{*/
+{
+	cout << "Model of " << rowsGridded << " of " << rowsGridded+rowsDirect
+	     << " visibilities predicted from grids, " << rowsDirect 
+	     << " with the direct sum only." << endl;
+}/*}}}*/
@@ -0,0 +1,86 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+#include <complex>
+#include <pthread.h>
+
+#include "ModsubChunkComputer.h"
+#include "Gridding.h"
+#include "Model.h"
+#include "PrimaryBeam.h"
+#include "DataIO.h"
+
+#ifndef __MODSUB_GRID_CHUNK_COMPUTER_H__
+#define __MODSUB_GRID_CHUNK_COMPUTER_H__
+
+// Model subtraction where point components are predicted from a uv grid.
+//
+// For each field and spectral window the point components are spread 
+// onto an image, which is Fourier transformed once in preCompute. Each 
+// visibility is then interpolated from the grid, so the cost no longer 
+// grows with the number of components, see UVGrid.
+//
+// Where the primary beam changes across a spectral window, the window is
+// gridded at a few channels and interpolated between them, see 
+// ChannelGrids. Extended components, components outside the image, and
+// visibilities outside the grid, are subtracted with the direct sum of 
+// ModsubChunkComputer.
+class ModsubGridChunkComputer: public ModsubChunkComputer
+{
+	private:
+		GridKernel kernel;
+		double requestedCell;
+		int requestedSize;
+
+		int nfields, nspw;
+		float* spwMaxFreq;
+
+		// Gridded components come first in the model for each field.
+		int* nGridded;
+		// Grids for [field*nspw+spw], NULL where the direct sum is used.
+		ChannelGrids** grids;
+
+		// Rows predicted from grids and rows without, for the summary in
+		// postCompute.
+		size_t rowsGridded, rowsDirect;
+		pthread_mutex_t countMutex;
+
+		// Releases the grids of the last preCompute.
+		void freeGrids();
+		void selectComponents(int fieldID, double& maxOffset);
+		bool gridded(Visibility& vis);
+
+	public:
+		// cell is the image pixel size in radians and size the number of
+		// pixels along each axis, a power of two. Visibilities with 
+		// |u| or |v| above 1/(2*GRID_PADDING*cell) wavelengths use the
+		// direct sum. If cell is 0 or less it is chosen so that the image
+		// holds all point components of each field. If size is 0 or less
+		// it is chosen for each field so that the grid reaches the 
+		// longest baseline of the data, see UVGrid::layout.
+		ModsubGridChunkComputer(Model* model, PrimaryBeam* pb, 
+		                        double cell = 0., int size = 0);
+		~ModsubGridChunkComputer();
+
+		void preCompute(DataIO* ms);
+		virtual void computeChunk(Chunk* chunk);
+		void postCompute(DataIO* ms);
+};
+
+#endif // inclusion guard
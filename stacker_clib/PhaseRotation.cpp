@@ -0,0 +1,268 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <cmath>
+#include <algorithm>
+
+#include "PhaseRotation.h"
+#include "FastMath.h"
+
+bool evenlySpaced(const float* freq, int nchan, double& freq0, double& dfreq)/*{{{*/
+{
+	freq0 = freq[0];
+	dfreq = 0.;
+	if(nchan < 2)
+		return true;
+
+	dfreq = (double(freq[nchan-1])-double(freq[0]))/(nchan-1);
+
+	// Frequencies are stored as float, allow for their rounding.
+	double maxfreq = std::max(std::fabs(double(freq[0])), 
+	                          std::fabs(double(freq[nchan-1])));
+	double tolerance = 2e-7*maxfreq;
+	for(int j = 1; j < nchan-1; j++)
+	{
+		if(std::fabs(double(freq[j]) - (freq0 + j*dfreq)) > tolerance)
+			return false;
+	}
+	return true;
+}/*}}}*/
+
+SIMD_DISPATCH
+void phaseFactors(float u, float v, float w, /*{{{*/
+                  const float* omega_x, const float* omega_y, 
+                  const float* omega_z, int npos, float sign, float* k)
+{
+#pragma omp simd aligned(omega_x, omega_y, omega_z, k: 64)
+	for(int p = 0; p < npos; p++)
+		k[p] = sign*(u*omega_x[p] + v*omega_y[p] + w*omega_z[p]);
+}/*}}}*/
+
+SIMD_DISPATCH
+void sumPhasorSeries(const float* k, int npos, double freq0, double dfreq,/*{{{*/
+                     const float* amp, int stride, int nchan, 
+                     float* re, float* im, float* work)
+{
+	float* z_re = work;
+	float* z_im = &work[npos];
+	float* step_re = &work[2*npos];
+	float* step_im = &work[3*npos];
+
+#pragma omp simd
+	for(int p = 0; p < npos; p++)
+	{
+		SinCos step = fastSinCos(double(k[p])*dfreq);
+		step_re[p] = step.c;
+		step_im[p] = step.s;
+	}
+
+	for(int j0 = 0; j0 < nchan; j0 += PHASE_RESYNC)
+	{
+		double freq = freq0 + j0*dfreq;
+#pragma omp simd
+		for(int p = 0; p < npos; p++)
+		{
+			SinCos z = fastSinCos(double(k[p])*freq);
+			z_re[p] = z.c;
+			z_im[p] = z.s;
+		}
+
+		int jend = std::min(nchan, j0+PHASE_RESYNC);
+		for(int j = j0; j < jend; j++)
+		{
+			const float* a = &amp[j*stride];
+			float sum_re = 0., sum_im = 0.;
+#pragma omp simd reduction(+:sum_re,sum_im)
+			for(int p = 0; p < npos; p++)
+			{
+				sum_re += a[p]*z_re[p];
+				sum_im += a[p]*z_im[p];
+
+				float z_re_next = z_re[p]*step_re[p] - z_im[p]*step_im[p];
+				z_im[p] = z_re[p]*step_im[p] + z_im[p]*step_re[p];
+				z_re[p] = z_re_next;
+			}
+			re[j] += sum_re;
+			im[j] += sum_im;
+		}
+	}
+}/*}}}*/
+
+SIMD_DISPATCH
+void sumPhasors(const float* k, int npos, const float* freq,/*{{{*/
+                const float* amp, int stride, int nchan, 
+                float* re, float* im)
+{
+	for(int j = 0; j < nchan; j++)
+	{
+		const float* a = &amp[j*stride];
+		double f = freq[j];
+		float sum_re = 0., sum_im = 0.;
+#pragma omp simd reduction(+:sum_re,sum_im)
+		for(int p = 0; p < npos; p++)
+		{
+			SinCos z = fastSinCos(double(k[p])*f);
+			sum_re += a[p]*z.c;
+			sum_im += a[p]*z.s;
+		}
+		re[j] += sum_re;
+		im[j] += sum_im;
+	}
+}/*}}}*/
+
+SIMD_DISPATCH
+void sumPhasorSeriesSkip(const float* k, int npos, double freq0, /*{{{*/
+                         double dfreq, const float* amp, int stride, 
+                         int nchan, const int* skip, 
+                         float* re, float* im, float* work)
+{
+	float* z_re = work;
+	float* z_im = &work[npos];
+	float* step_re = &work[2*npos];
+	float* step_im = &work[3*npos];
+
+#pragma omp simd
+	for(int p = 0; p < npos; p++)
+	{
+		SinCos step = fastSinCos(double(k[p])*dfreq);
+		step_re[p] = step.c;
+		step_im[p] = step.s;
+	}
+
+	int j = 0;
+	while(j < nchan)
+	{
+		if(skip[j])
+		{
+			j++;
+			continue;
+		}
+
+		double freq = freq0 + j*dfreq;
+#pragma omp simd
+		for(int p = 0; p < npos; p++)
+		{
+			SinCos z = fastSinCos(double(k[p])*freq);
+			z_re[p] = z.c;
+			z_im[p] = z.s;
+		}
+
+		int jend = std::min(nchan, j+PHASE_RESYNC);
+		for(; j < jend; j++)
+		{
+			bool accumulate = not skip[j];
+
+			// Short runs of skipped channels only advance the phasor,
+			// long runs are jumped over and the phasor is seeded again.
+			if(not accumulate and not skip[j-1])
+			{
+				int run = 1;
+				while(j+run < nchan and skip[j+run])
+					run++;
+				if(run >= SKIP_RESEED)
+				{
+					j += run;
+					break;
+				}
+			}
+
+			const float* a = &amp[j*stride];
+			float sum_re = 0., sum_im = 0.;
+			if(accumulate)
+			{
+#pragma omp simd reduction(+:sum_re,sum_im)
+				for(int p = 0; p < npos; p++)
+				{
+					sum_re += a[p]*z_re[p];
+					sum_im += a[p]*z_im[p];
+
+					float z_re_next = z_re[p]*step_re[p] - z_im[p]*step_im[p];
+					z_im[p] = z_re[p]*step_im[p] + z_im[p]*step_re[p];
+					z_re[p] = z_re_next;
+				}
+				re[j] += sum_re;
+				im[j] += sum_im;
+			}
+			else
+			{
+#pragma omp simd
+				for(int p = 0; p < npos; p++)
+				{
+					float z_re_next = z_re[p]*step_re[p] - z_im[p]*step_im[p];
+					z_im[p] = z_re[p]*step_im[p] + z_im[p]*step_re[p];
+					z_re[p] = z_re_next;
+				}
+			}
+		}
+	}
+}/*}}}*/
+
+SIMD_DISPATCH
+void sumPhasorsSkip(const float* k, int npos, const float* freq,/*{{{*/
+                    const float* amp, int stride, int nchan, 
+                    const int* skip, float* re, float* im)
+{
+	for(int j = 0; j < nchan; j++)
+	{
+		if(skip[j])
+			continue;
+
+		const float* a = &amp[j*stride];
+		double f = freq[j];
+		float sum_re = 0., sum_im = 0.;
+#pragma omp simd reduction(+:sum_re,sum_im)
+		for(int p = 0; p < npos; p++)
+		{
+			SinCos z = fastSinCos(double(k[p])*f);
+			sum_re += a[p]*z.c;
+			sum_im += a[p]*z.s;
+		}
+		re[j] += sum_re;
+		im[j] += sum_im;
+	}
+}/*}}}*/
+
+SIMD_DISPATCH
+void sumPhasorsAtFreq(const float* k, int npos, double freq,/*{{{*/
+                      const float* amp, const float* extent,
+                      float& re, float& im)
+{
+	float sum_re = 0., sum_im = 0.;
+	if(extent == NULL)
+	{
+#pragma omp simd reduction(+:sum_re,sum_im)
+		for(int p = 0; p < npos; p++)
+		{
+			SinCos z = fastSinCos(double(k[p])*freq);
+			sum_re += amp[p]*z.c;
+			sum_im += amp[p]*z.s;
+		}
+	}
+	else
+	{
+#pragma omp simd reduction(+:sum_re,sum_im)
+		for(int p = 0; p < npos; p++)
+		{
+			SinCos z = fastSinCos(double(k[p])*freq);
+			sum_re += amp[p]*extent[p]*z.c;
+			sum_im += amp[p]*extent[p]*z.s;
+		}
+	}
+	re = sum_re;
+	im = sum_im;
+}/*}}}*/
@@ -0,0 +1,78 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+// Phase rotation over channels.
+//
+// Sums of amp*exp(i*k*freq) over many positions are needed for every
+// channel of a visibility. When channels are evenly spaced the phasor
+// of a channel follows from the previous one by a single complex
+// multiplication, which is much cheaper than sin and cos. The phasor is
+// recomputed exactly every PHASE_RESYNC channels to keep rounding errors
+// from building up.
+//
+// Position arrays must be allocated with allocAligned, npos is the
+// padded number of positions and padding must have zero amplitude.
+
+#ifndef __PHASE_ROTATION_H__
+#define __PHASE_ROTATION_H__
+
+// Number of channels between exact evaluations of the phasor.
+const int PHASE_RESYNC = 64;
+// Shortest run of skipped channels where seeding the phasor again is 
+// cheaper than stepping over the run.
+const int SKIP_RESEED = 8;
+
+// True if freq[j] = freq0 + j*dfreq for j < nchan, within float precision.
+bool evenlySpaced(const float* freq, int nchan, double& freq0, double& dfreq);
+
+// k[p] = sign*(u*omega_x[p] + v*omega_y[p] + w*omega_z[p]) for p < npos.
+void phaseFactors(float u, float v, float w, 
+                  const float* omega_x, const float* omega_y, 
+                  const float* omega_z, int npos, float sign, float* k);
+
+// Adds sum_p amp[j*stride+p]*exp(i*k[p]*(freq0+j*dfreq)) to (re[j], im[j])
+// for j < nchan, using the recurrence. work must hold 4*npos floats.
+void sumPhasorSeries(const float* k, int npos, double freq0, double dfreq,
+                     const float* amp, int stride, int nchan, 
+                     float* re, float* im, float* work);
+
+// Adds sum_p amp[j*stride+p]*exp(i*k[p]*freq[j]) to (re[j], im[j])
+// for j < nchan, for channels that are not evenly spaced.
+void sumPhasors(const float* k, int npos, const float* freq,
+                const float* amp, int stride, int nchan, 
+                float* re, float* im);
+
+// As sumPhasorSeries and sumPhasors, but channels with skip[j] != 0,
+// e.g. flagged channels, are neither evaluated nor changed. The 
+// recurrence steps over runs of skipped channels shorter than 
+// SKIP_RESEED, and is seeded again after longer runs.
+void sumPhasorSeriesSkip(const float* k, int npos, double freq0, double dfreq,
+                         const float* amp, int stride, int nchan, 
+                         const int* skip, float* re, float* im, float* work);
+void sumPhasorsSkip(const float* k, int npos, const float* freq,
+                    const float* amp, int stride, int nchan, 
+                    const int* skip, float* re, float* im);
+
+// Returns sum_p amp[p]*extent[p]*exp(i*k[p]*freq) in re and im.
+// extent can be NULL if all extents are one.
+void sumPhasorsAtFreq(const float* k, int npos, double freq,
+                      const float* amp, const float* extent,
+                      float& re, float& im);
+
+#endif // inclusion guard
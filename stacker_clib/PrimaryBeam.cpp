@@ -19,6 +19,8 @@
 #include <iostream>
 #include "definitions.h"
 #include <limits.h>
+#include <algorithm>
+#include <cmath>
 
 
 PrimaryBeam::PrimaryBeam() {}
@@ -26,45 +28,222 @@ PrimaryBeam::~PrimaryBeam() {}
 ConstantPrimaryBeam::ConstantPrimaryBeam() {}
 ConstantPrimaryBeam::~ConstantPrimaryBeam() {}
 
-ImagePrimaryBeam::ImagePrimaryBeam(const char fileName[])
+GaussianPrimaryBeam::GaussianPrimaryBeam(double dishdia, double freq0)
+{
+	this->dishdia = dishdia;
+	this->freq0 = freq0;
+}
+
+GaussianPrimaryBeam::~GaussianPrimaryBeam() {}
+
+AiryPrimaryBeam::AiryPrimaryBeam(double dishdia, double freq0)
+{
+	this->dishdia = dishdia;
+	this->freq0 = freq0;
+}
+
+AiryPrimaryBeam::~AiryPrimaryBeam() {}
+
+ImagePrimaryBeam::ImagePrimaryBeam(const char fileName[], int interpolation)
 {
 	nx = 0;
 	ny = 0;
+	nplanes = 0;
 	x0 = 0.;
 	y0 = 0.;
 	dx = 1.;
 	dy = 1.;
 	px_x0 = 0;
 	px_y0 = 0;
-	freq0 = 0.;
+	plane_freq = NULL;
 	data = NULL;
+	this->interpolation = interpolation;
 }
 
 ImagePrimaryBeam::~ImagePrimaryBeam()
 {
+	delete[] data;
+	delete[] plane_freq;
 }
 
 
+float PrimaryBeam::cutoffRadius(float level, float freq)
+{
+	return -1.;
+}
+
 float ConstantPrimaryBeam::calc(float x, float y, float freq)
 {
 	return 1.;
 }
 
-// This function could be improved by adding interpolation,
-// currently closest value is always used
-float ImagePrimaryBeam::calc(float x, float y, float freq)
+float GaussianPrimaryBeam::calc(float x, float y, float freq)
 {
-	float freqcomp = 1.;
-	if(freq > tol && freq0 > tol)
-		freqcomp = freq0/freq;
+	double f = freq > tol ? double(freq) : freq0;
+	if(f <= tol || dishdia <= tol)
+		return 0.;
 
-	int px_x, px_y;
-	px_x = int(freqcomp*(x-x0)/dx+px_x0);
-	px_y = int(freqcomp*(y-y0)/dy+px_y0);
+	double fwhm = 1.22*c/(f*dishdia);
+	return float(exp(-4.*log(2.)*(double(x)*x+double(y)*y)/(fwhm*fwhm)));
+}
 
+float AiryPrimaryBeam::calc(float x, float y, float freq)
+{
+	double f = freq > tol ? double(freq) : freq0;
+	if(f <= tol || dishdia <= tol)
+		return 0.;
+
+	double v = pi*dishdia*f/c*sqrt(double(x)*x+double(y)*y);
+	if(v < 1e-6)
+		return 1.;
+
+	double amp = 2.*j1(v)/v;
+	return float(amp*amp);
+}
+
+float GaussianPrimaryBeam::cutoffRadius(float level, float freq)
+{
+	double f = freq > tol ? double(freq) : freq0;
+	if(f <= tol || dishdia <= tol || level <= 0.)
+		return -1.;
+	if(level >= 1.)
+		return 0.;
 
-	if(px_x < 0 || px_x >= nx) return 0.;
-	if(px_y < 0 || px_y >= ny) return 0.;
-	if(data == NULL) return 0.;
-	return data[px_y][px_x];
+	double fwhm = 1.22*c/(f*dishdia);
+	return float(fwhm*sqrt(log(1./level)/(4.*log(2.))));
 }
+
+// Bounded by the envelope of the sidelobes, (2 J1(v)/v)^2 <= 8/(pi v^3).
+float AiryPrimaryBeam::cutoffRadius(float level, float freq)
+{
+	double f = freq > tol ? double(freq) : freq0;
+	if(f <= tol || dishdia <= tol || level <= 0.)
+		return -1.;
+
+	double v = std::max(pow(8./(pi*level), 1./3.), 3.8317);
+	return float(v*c/(pi*dishdia*f));
+}
+
+// Catmull-Rom weights for the four pixels around a point at fraction t
+// from the second pixel.
+static inline void cubicWeights(float t, float w[4])
+{
+	float t2 = t*t;
+	float t3 = t2*t;
+	w[0] = 0.5f*(-t3 + 2.f*t2 - t);
+	w[1] = 0.5f*(3.f*t3 - 5.f*t2 + 2.f);
+	w[2] = 0.5f*(-3.f*t3 + 4.f*t2 + t);
+	w[3] = 0.5f*(t3 - t2);
+}
+
+float ImagePrimaryBeam::calcPlane(int plane, float x, float y, float freq) /*{{{*/
+{
+	float freqcomp = 1.;
+	if(freq > tol && plane_freq[plane] > tol)
+		freqcomp = plane_freq[plane]/freq;
+
+	// Position in pixels, relative to the centre of pixel (0,0).
+	float p_x = freqcomp*(x-x0)/dx+px_x0;
+	float p_y = freqcomp*(y-y0)/dy+px_y0;
+
+	if(p_x < -0.5f || p_x > nx-0.5f) return 0.;
+	if(p_y < -0.5f || p_y > ny-0.5f) return 0.;
+
+	const float* img = &data[size_t(plane)*nx*ny];
+
+	if(interpolation == PB_INTERP_NEAREST)
+	{
+		int px_x = std::min(int(p_x+0.5f), nx-1);
+		int px_y = std::min(int(p_y+0.5f), ny-1);
+		return img[px_y*nx+px_x];
+	}
+
+	// Points within half a pixel of the edge use the edge pixels.
+	p_x = std::max(0.f, std::min(p_x, float(nx-1)));
+	p_y = std::max(0.f, std::min(p_y, float(ny-1)));
+	int px_x = std::min(int(p_x), std::max(nx-2, 0));
+	int px_y = std::min(int(p_y), std::max(ny-2, 0));
+	float t_x = p_x-px_x;
+	float t_y = p_y-px_y;
+
+	if(interpolation == PB_INTERP_CUBIC)
+	{
+		float w_x[4], w_y[4];
+		cubicWeights(t_x, w_x);
+		cubicWeights(t_y, w_y);
+
+		float value = 0.;
+		for(int j = 0; j < 4; j++)
+		{
+			int row = std::max(0, std::min(px_y-1+j, ny-1));
+			float rowvalue = 0.;
+			for(int i = 0; i < 4; i++)
+			{
+				int col = std::max(0, std::min(px_x-1+i, nx-1));
+				rowvalue += w_x[i]*img[row*nx+col];
+			}
+			value += w_y[j]*rowvalue;
+		}
+		return value;
+	}
+
+	int px_x1 = std::min(px_x+1, nx-1);
+	int px_y1 = std::min(px_y+1, ny-1);
+	return (1.f-t_y)*((1.f-t_x)*img[px_y*nx+px_x] + t_x*img[px_y*nx+px_x1])
+	     + t_y*((1.f-t_x)*img[px_y1*nx+px_x] + t_x*img[px_y1*nx+px_x1]);
+}/*}}}*/
+
+// Largest distance from the reference position of any pixel above
+// level, plus two pixels for the interpolation.
+float ImagePrimaryBeam::cutoffRadius(float level, float freq) /*{{{*/
+{
+	if(data == NULL || nplanes == 0)
+		return 0.;
+
+	float radius = 0.;
+	for(int plane = 0; plane < nplanes; plane++)
+	{
+		float freqcomp = 1.;
+		if(freq > tol && plane_freq[plane] > tol)
+			freqcomp = plane_freq[plane]/freq;
+
+		float maxdist = -1.;
+		const float* img = &data[size_t(plane)*nx*ny];
+		for(int px_y = 0; px_y < ny; px_y++)
+			for(int px_x = 0; px_x < nx; px_x++)
+				if(img[px_y*nx+px_x] > level)
+					maxdist = std::max(maxdist, float(hypot(px_x-px_x0, px_y-px_y0)));
+
+		if(maxdist >= 0.)
+			radius = std::max(radius, 
+			                  (maxdist+2.f)*std::max(fabsf(dx), fabsf(dy))/freqcomp);
+	}
+	return radius + float(hypot(x0, y0));
+}/*}}}*/
+
+float ImagePrimaryBeam::calc(float x, float y, float freq) /*{{{*/
+{
+	if(data == NULL || nplanes == 0) return 0.;
+
+	if(nplanes == 1 || freq <= tol)
+		return calcPlane(0, x, y, freq);
+
+	// Planes are assumed to be ordered in frequency, either increasing
+	// or decreasing.
+	bool increasing = plane_freq[nplanes-1] > plane_freq[0];
+	int plane = 0;
+	while(plane < nplanes-2 && 
+	      (increasing ? plane_freq[plane+1] < freq : plane_freq[plane+1] > freq))
+		plane++;
+
+	float t = 0.;
+	if(plane_freq[plane+1] != plane_freq[plane])
+		t = (freq-plane_freq[plane])/(plane_freq[plane+1]-plane_freq[plane]);
+	t = std::max(0.f, std::min(t, 1.f));
+
+	if(interpolation == PB_INTERP_NEAREST)
+		return calcPlane(t < 0.5f ? plane : plane+1, x, y, freq);
+
+	return (1.f-t)*calcPlane(plane, x, y, freq) 
+	     + t*calcPlane(plane+1, x, y, freq);
+}/*}}}*/
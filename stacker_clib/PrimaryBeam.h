@@ -17,12 +17,14 @@
 //
 // Library to stack and modsub ms data.
 
+#include "definitions.h"
+
 #ifndef __PRIMARYBEAM_H__
 #define __PRIMARYBEAM_H__
 
 class PrimaryBeam
 {
-	private:
+	protected:
 #if __cplusplus < 201103
 		static const double pi = 3.141592653589793238462;
 #else
@@ -33,6 +35,10 @@ class PrimaryBeam
 		PrimaryBeam();
 		~PrimaryBeam();
 		virtual float calc(float x, float y, float freq = 0.) = 0;
+
+		// Radius (in radians) outside of which calc is below level at
+		// frequency freq. Negative if not known.
+		virtual float cutoffRadius(float level, float freq = 0.);
 };
 
 class ConstantPrimaryBeam: public PrimaryBeam
@@ -43,19 +49,60 @@ class ConstantPrimaryBeam: public PrimaryBeam
 		virtual float calc(float x, float y, float freq = 0.);
 };
 
+// Gaussian beam of a dish with diameter dishdia (in m), with 
+// FWHM 1.22 c/(freq dishdia). freq0 is used if no frequency is given.
+class GaussianPrimaryBeam: public PrimaryBeam
+{
+	private:
+		double dishdia, freq0;
+
+	public:
+		GaussianPrimaryBeam(double dishdia, double freq0 = 0.);
+		~GaussianPrimaryBeam();
+		virtual float calc(float x, float y, float freq = 0.);
+		virtual float cutoffRadius(float level, float freq = 0.);
+};
+
+// Airy pattern (2 J1(v)/v)^2 of a uniformly illuminated dish with 
+// diameter dishdia (in m), v = pi dishdia r freq/c.
+// freq0 is used if no frequency is given.
+class AiryPrimaryBeam: public PrimaryBeam
+{
+	private:
+		double dishdia, freq0;
+
+	public:
+		AiryPrimaryBeam(double dishdia, double freq0 = 0.);
+		~AiryPrimaryBeam();
+		virtual float calc(float x, float y, float freq = 0.);
+		virtual float cutoffRadius(float level, float freq = 0.);
+};
+
+// Primary beam from an image with one or more frequency planes.
+//
+// Planes are stored contiguously in data as [plane][y][x]. Each plane
+// is scaled with plane_freq/freq, and for cubes the two planes closest
+// in frequency are interpolated linearly. Within a plane the beam is
+// interpolated with PB_INTERP_NEAREST, PB_INTERP_LINEAR or
+// PB_INTERP_CUBIC.
 class ImagePrimaryBeam: public PrimaryBeam
 {
 	protected:
-		float** data;
-		int nx, ny;
+		float* data;
+		int nx, ny, nplanes;
 		float x0, y0, dx, dy, px_x0, px_y0;
-		float freq0;
+		float* plane_freq;
+		int interpolation;
+
+		float calcPlane(int plane, float x, float y, float freq);
 
 	public:
-		ImagePrimaryBeam(const char fileName[]);
+		ImagePrimaryBeam(const char fileName[], 
+		                 int interpolation = PB_INTERP_LINEAR);
 		~ImagePrimaryBeam();
 
 		virtual float calc(float x, float y, float freq = 0.);
+		virtual float cutoffRadius(float level, float freq = 0.);
 };
 
 #endif
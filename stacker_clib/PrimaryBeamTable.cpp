@@ -0,0 +1,233 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <iostream>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "PrimaryBeamTable.h"
+#include "FastMath.h"
+#include "definitions.h"
+
+using std::cout;
+using std::endl;
+
+PrimaryBeamTable::PrimaryBeamTable()
+{
+	nfields = 0;
+	nspw = 0;
+	nchan = 0;
+	nsample = 0;
+	step = 1;
+	stride_ = NULL;
+	lastChan = NULL;
+	values = NULL;
+	sumsq = NULL;
+}
+
+PrimaryBeamTable::~PrimaryBeamTable()
+{
+	free();
+}
+
+void PrimaryBeamTable::free()
+{
+	for(int field = 0; field < nfields; field++)
+	{
+		freeAligned(values[field]);
+		delete[] sumsq[field];
+	}
+	delete[] values;
+	delete[] sumsq;
+	delete[] stride_;
+	delete[] lastChan;
+	values = NULL;
+	sumsq = NULL;
+	stride_ = NULL;
+	lastChan = NULL;
+	nfields = 0;
+}
+
+struct PBTableTask
+{
+	PrimaryBeamTable* table;
+	PrimaryBeam* pb;
+	DataIO* data;
+	int* npos;
+	float** dx;
+	float** dy;
+	float** scale;
+	// Range of rows, numbered field by field, then by spw and sample.
+	size_t begin, end;
+};
+
+void* pbTableThread(void* data) /*{{{*/
+{
+	PBTableTask* task = (PBTableTask*)data;
+	PrimaryBeamTable& table = *task->table;
+	size_t rowsPerField = size_t(table.nspw)*table.nsample;
+
+	for(size_t i = task->begin; i < task->end; i++)
+	{
+		int field = int(i/rowsPerField);
+		int spw = int(i%rowsPerField)/table.nsample;
+		int k = int(i%rowsPerField)%table.nsample;
+		int chan = std::min(k*table.step, table.lastChan[spw]);
+		float freq = task->data->getFreq(spw)[chan];
+
+		float* r = table.sample(field, spw, k);
+		float s = 0.;
+		for(int i_p = 0; i_p < task->npos[field]; i_p++)
+		{
+			float pbcor = task->pb->calc(task->dx[field][i_p], 
+			                             task->dy[field][i_p], freq);
+			r[i_p] = pbcor*task->scale[field][i_p];
+			s += pbcor*r[i_p];
+		}
+		table.sumsq[field][spw*table.nsample+k] = s;
+	}
+
+	return NULL;
+}/*}}}*/
+
+void PrimaryBeamTable::compute(DataIO* data, PrimaryBeam& pb, int nfields, /*{{{*/
+                               int* npos, float** dx, float** dy, float** scale)
+{
+	free();
+
+	this->nfields = nfields;
+	nspw = int(data->nSpw());
+	nchan = int(data->nChan());
+
+	// Spectral windows with fewer channels are padded with zeros, which
+	// must not be used for interpolation.
+	lastChan = new int[nspw];
+	for(int spw = 0; spw < nspw; spw++)
+	{
+		float* freq = data->getFreq(spw);
+		lastChan[spw] = 0;
+		while(lastChan[spw] < nchan-1 and freq[lastChan[spw]+1] > 0.)
+			lastChan[spw]++;
+	}
+
+	stride_ = new int[nfields];
+	size_t npos_total = 0;
+	for(int field = 0; field < nfields; field++)
+	{
+		stride_[field] = int(paddedSize(npos[field]));
+		npos_total += stride_[field];
+	}
+
+	// Store fewer channels if a row for each does not fit.
+	double budget = PBTABLE_MEMORY_FRACTION*
+	                double(sysconf(_SC_AVPHYS_PAGES))*
+	                double(sysconf(_SC_PAGESIZE));
+	double bytesPerSample = double(npos_total)*nspw*sizeof(float);
+	step = 1;
+	nsample = std::max(nchan, 1);
+	if(nchan > 2 and bytesPerSample*nchan > budget)
+	{
+		int maxSamples = std::max(2, int(budget/bytesPerSample));
+		step = (nchan-1+maxSamples-2)/(maxSamples-1);
+		nsample = (nchan-1+step-1)/step+1;
+		cout << "Primary beam table needs " 
+		     << bytesPerSample*nchan/1024/1024 << " MB, storing every "
+		     << step << " channels and interpolating between them." << endl;
+	}
+
+	values = new float*[nfields];
+	sumsq = new float*[nfields];
+	for(int field = 0; field < nfields; field++)
+	{
+		values[field] = allocAligned(size_t(nspw)*nsample*stride_[field]);
+		sumsq[field] = new float[nspw*nsample];
+	}
+
+	// Rows are split between threads as positions in findVisible.
+	size_t nrows = size_t(nfields)*nspw*nsample;
+	int n_thread = int(sysconf(_SC_NPROCESSORS_ONLN));
+	n_thread = int(std::max(size_t(1), std::min(size_t(n_thread), nrows)));
+
+	PBTableTask* tasks = new PBTableTask[n_thread];
+	pthread_t* threads = new pthread_t[n_thread];
+	for(int t = 0; t < n_thread; t++)
+	{
+		tasks[t].table = this;
+		tasks[t].pb = &pb;
+		tasks[t].data = data;
+		tasks[t].npos = npos;
+		tasks[t].dx = dx;
+		tasks[t].dy = dy;
+		tasks[t].scale = scale;
+		tasks[t].begin = nrows*t/n_thread;
+		tasks[t].end = nrows*(t+1)/n_thread;
+		pthread_create(&threads[t], NULL, pbTableThread, (void*)&tasks[t]);
+	}
+	for(int t = 0; t < n_thread; t++)
+		pthread_join(threads[t], NULL);
+
+	delete[] tasks;
+	delete[] threads;
+}/*}}}*/
+
+void PrimaryBeamTable::bracket(int spw, int chan, int& k, float& t) /*{{{*/
+{
+	k = std::min(chan/step, std::max(nsample-2, 0));
+	int chan0 = std::min(k*step, lastChan[spw]);
+	int chan1 = std::min((k+1)*step, lastChan[spw]);
+	t = chan1 > chan0 ? float(chan-chan0)/float(chan1-chan0) : 0.f;
+}/*}}}*/
+
+const float* PrimaryBeamTable::block(int field, int spw, int chan0, /*{{{*/
+                                     int nchan, int p0, int npos, 
+                                     float* buffer, int& stride)
+{
+	if(step == 1)
+	{
+		stride = stride_[field];
+		return &sample(field, spw, chan0)[p0];
+	}
+
+	stride = npos;
+	for(int j = 0; j < nchan; j++)
+	{
+		int k;
+		float t;
+		bracket(spw, chan0+j, k, t);
+		const float* r0 = &sample(field, spw, k)[p0];
+		const float* r1 = &sample(field, spw, std::min(k+1, nsample-1))[p0];
+		float* r = &buffer[size_t(j)*npos];
+		for(int i = 0; i < npos; i++)
+			r[i] = r0[i] + t*(r1[i]-r0[i]);
+	}
+	return buffer;
+}/*}}}*/
+
+float PrimaryBeamTable::sumSquares(int field, int spw, int chan) /*{{{*/
+{
+	if(step == 1)
+		return sumsq[field][spw*nsample+chan];
+
+	int k;
+	float t;
+	bracket(spw, chan, k, t);
+	float s0 = sumsq[field][spw*nsample+k];
+	float s1 = sumsq[field][spw*nsample+std::min(k+1, nsample-1)];
+	return s0 + t*(s1-s0);
+}/*}}}*/
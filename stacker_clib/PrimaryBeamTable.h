@@ -0,0 +1,96 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+#include "PrimaryBeam.h"
+#include "DataIO.h"
+
+#ifndef __PRIMARY_BEAM_TABLE_H__
+#define __PRIMARY_BEAM_TABLE_H__
+
+// Primary beam evaluated for every field, spectral window, channel 
+// and position, multiplied by a per-position scale (stacking weight 
+// or model flux). Computed once in preCompute so that the chunk 
+// computers do not call PrimaryBeam::calc for every visibility.
+//
+// For each field the values are stored as [spw][sample][pos], where 
+// each [pos] row is aligned and zero padded to stride(field) floats so
+// that it can be passed directly to the kernels in PhaseRotation.h.
+// Normally every channel is a sample. If a row for every channel does
+// not fit in PBTABLE_MEMORY_FRACTION of the free memory, only every 
+// step channels are stored and the channels between them are 
+// interpolated linearly in channel number.
+class PrimaryBeamTable
+{
+	private:
+		int nfields;
+		int nspw;
+		int nchan;
+		int nsample;
+		int step;
+		// Last channel with a frequency in each spectral window.
+		int* lastChan;
+		int* stride_;
+		float** values;
+		float** sumsq;
+
+		void free();
+		// Samples k and k+1 around chan and weight t of sample k+1.
+		void bracket(int spw, int chan, int& k, float& t);
+		float* sample(int field, int spw, int k)
+		{
+			return &values[field][(size_t(spw)*nsample+k)*stride_[field]];
+		};
+
+		friend void* pbTableThread(void* data);
+
+	public:
+		PrimaryBeamTable();
+		~PrimaryBeamTable();
+
+		// dx, dy and scale are indexed [field][pos], as in Coords and Model.
+		// Rows are filled by several threads.
+		void compute(DataIO* data, PrimaryBeam& pb, int nfields, 
+		             int* npos, float** dx, float** dy, float** scale);
+
+		int stride(int field) { return stride_[field]; };
+		// True if only every step channels are stored.
+		bool interpolated() { return step > 1; };
+
+		// Rows of scale*pb for nchan channels from chan0, at positions 
+		// p0 to p0+npos-1, where p0 and npos are multiples of SIMD_WIDTH.
+		// Row j starts at j*stride of the returned pointer. Points into
+		// the table, or if interpolated(), into buffer, which must then 
+		// hold nchan*npos floats and be allocated with allocAligned.
+		const float* block(int field, int spw, int chan0, int nchan, 
+		                   int p0, int npos, float* buffer, int& stride);
+
+		// Row of scale*pb for all positions in the field, buffer is used
+		// as in block and must hold stride(field) floats.
+		const float* row(int field, int spw, int chan, float* buffer)
+		{
+			int unused;
+			return block(field, spw, chan, 1, 0, stride_[field], 
+			             buffer, unused);
+		};
+
+		// Sum over positions of scale*pb*pb.
+		float sumSquares(int field, int spw, int chan);
+};
+
+#endif // inclusion guard
@@ -0,0 +1,95 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include "Reduction.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+ThreadReduction::ThreadReduction()
+{
+	nthread = 0;
+	nvalue = 0;
+	stride = 0;
+	sums_ = NULL;
+	merged = NULL;
+	pthread_mutex_init(&sharedMutex, NULL);
+}
+
+ThreadReduction::~ThreadReduction()
+{
+	free(sums_);
+	delete[] merged;
+	pthread_mutex_destroy(&sharedMutex);
+}
+
+void ThreadReduction::init(int nthread, int nvalue)/*{{{*/
+{
+	free(sums_);
+	delete[] merged;
+
+	this->nthread = nthread;
+	this->nvalue = nvalue;
+
+	// Sums of each thread fill whole cache lines, and the block starts
+	// on a line, so no two threads write to the same line.
+	const int perLine = int(CACHE_LINE/sizeof(KahanSum));
+	stride = ((nvalue+perLine-1)/perLine)*perLine;
+	if(stride == 0)
+		stride = perLine;
+
+	// One extra slot after the threads for addShared.
+	int n = (nthread+1)*stride;
+	void* p = NULL;
+	if(posix_memalign(&p, CACHE_LINE, n*sizeof(KahanSum)) != 0)
+		throw std::bad_alloc();
+	sums_ = (KahanSum*)p;
+	for(int i = 0; i < n; i++)
+		new(&sums_[i]) KahanSum();
+	merged = NULL;
+}/*}}}*/
+
+void ThreadReduction::addShared(const KahanSum* values)/*{{{*/
+{
+	pthread_mutex_lock(&sharedMutex);
+	KahanSum* shared = sums(nthread);
+	for(int i = 0; i < nvalue; i++)
+		shared[i].add(values[i]);
+	pthread_mutex_unlock(&sharedMutex);
+}/*}}}*/
+
+void ThreadReduction::merge()/*{{{*/
+{
+	delete[] merged;
+	merged = new double[nvalue];
+
+	for(int i = 0; i < nvalue; i++)
+	{
+		KahanSum total;
+		for(int thread = 0; thread < nthread+1; thread++)
+			total.add(sums(thread)[i]);
+		merged[i] = total.sum;
+	}
+}/*}}}*/
+
+double ThreadReduction::result(int i)/*{{{*/
+{
+	if(merged == NULL)
+		return 0.;
+	return merged[i];
+}/*}}}*/
@@ -0,0 +1,96 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+#include <pthread.h>
+#include <cstddef>
+
+#ifndef __REDUCTION_H__
+#define __REDUCTION_H__
+
+const size_t CACHE_LINE = 64;
+
+// Double sum with Kahan compensation, the error relative to the sum of
+// absolute values of the terms does not grow with the number of terms. 
+// Relies on strict floating point, do not compile 
+// with -ffast-math.
+struct KahanSum
+{
+	double sum, c;
+
+	KahanSum() : sum(0.), c(0.) {};
+
+	void add(double x)
+	{
+		double y = x - c;
+		double t = sum + y;
+		c = (t - sum) - y;
+		sum = t;
+	};
+
+	void add(const KahanSum& x)
+	{
+		add(x.sum);
+		add(-x.c);
+	};
+};
+
+// Thread local sums of nvalue results for chunk computers that reduce
+// the data, e.g. to a flux. Each computer thread adds to its own sums 
+// without locking, and the sums of all threads are merged once the
+// computation is done. Every sum is compensated, so its error stays 
+// within a few roundings of the sum of the absolute values of its terms
+// however many terms are added. The result is not independent of how
+// chunks were scheduled, sums that cancel, like stacked noise, can 
+// differ in the last bits between runs.
+class ThreadReduction
+{
+	private:
+		int nthread;
+		int nvalue;
+		// Sums of each thread start on a separate cache line, sums_ is 
+		// aligned to CACHE_LINE.
+		int stride;
+		KahanSum* sums_;
+		double* merged;
+
+		pthread_mutex_t sharedMutex;
+
+	public:
+		ThreadReduction();
+		~ThreadReduction();
+
+		// Sets up and zeroes sums for nthread threads.
+		void init(int nthread, int nvalue);
+
+		// Sums of computer thread number thread, only to be used 
+		// from that thread.
+		KahanSum* sums(int thread) { return &sums_[thread*stride]; };
+
+		// Adds values from a caller that does not know its thread number.
+		void addShared(const KahanSum* values);
+
+		// Merges the sums of all threads, call after all threads are done.
+		void merge();
+
+		int size() { return nvalue; };
+		// Merged result i, 0 if nothing has been merged.
+		double result(int i);
+};
+
+#endif // inclusion guard
@@ -16,11 +16,15 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
 //
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 #include "StackChunkComputer.h"
 #include "Chunk.h"
 #include "Coords.h"
 #include "PrimaryBeam.h"
+#include "PhaseRotation.h"
+#include "FastMath.h"
 
 using std::real;
 
@@ -29,6 +33,15 @@ StackChunkComputer::StackChunkComputer(Coords* coords, PrimaryBeam* pb)
 	this->coords = coords;
 	this->pb = pb;
 	stackingMode = 0;
+	redoWeights = false;
+	accumulateOnly = false;
+	nbin = 0;
+	bins = NULL;
+}
+
+StackChunkComputer::~StackChunkComputer()
+{
+	delete[] bins;
 }
 
 void StackChunkComputer::setStackingMode(int mode)
@@ -36,88 +49,160 @@ void StackChunkComputer::setStackingMode(int mode)
 	stackingMode = mode;
 }
 
+void StackChunkComputer::setRedoWeights(bool redo)
+{
+	redoWeights = redo;
+}
+
+void StackChunkComputer::setAccumulateOnly(bool accumulate)
+{
+	accumulateOnly = accumulate;
+}
+
+void StackChunkComputer::setProfileBins(double* bins, int nbin)
+{
+	delete[] this->bins;
+	this->nbin = nbin;
+	this->bins = new float[nbin+1];
+	for(int i = 0; i < nbin+1; i++)
+		this->bins[i] = float(bins[i]);
+}
+
+void StackChunkComputer::computeChunk(Chunk* chunk, int thread) /*{{{*/
+{
+	// Each thread has its own sums, so no locking is needed.
+	stackChunk(chunk, reduction.sums(thread));
+}/*}}}*/
+
 void StackChunkComputer::computeChunk(Chunk* chunk) /*{{{*/
 {
-	float sum = 0., normsum = 0.;
+	// Thread is not known, sums for the chunk are added to the shared
+	// slot of the reduction.
+	KahanSum* sums = new KahanSum[reduction.size()];
+	stackChunk(chunk, sums);
+	reduction.addShared(sums);
+	delete[] sums;
+}/*}}}*/
+
+// Applies the phase shifts of channel block chan0 to the visibilities and
+// adds them to sums, see stackChunk. NSTOKES is the number of correlations
+// in every row, or 0 to use the number in each row.
+template<int NSTOKES>
+void StackChunkComputer::applyPhases(Chunk* chunk, int chan0, /*{{{*/
+                                     float* dd_real, float* dd_imag, 
+                                     const int* nskip, KahanSum* sums)
+{
+	bool store = not accumulateOnly;
+	int block = std::min(CHANNEL_BLOCK, int(chunk->nChan()));
+
 	for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
 	{
-		// Shorthands to make code more readable.
 		Visibility& inVis = chunk->inVis[uvrow];
 		Visibility& outVis = chunk->outVis[uvrow];
-		float &u = inVis.u;
-		float &v = inVis.v;
-		float &w = inVis.w;
-
-		// Field ID is for which pointing the visibility is in.
+		const int nstokes = NSTOKES > 0 ? NSTOKES : inVis.nstokes;
 		int fieldID = inVis.fieldID;
+		int nchan = std::min(CHANNEL_BLOCK, inVis.nchan-chan0);
+		float* re = &dd_real[uvrow*block];
+		float* im = &dd_imag[uvrow*block];
+		double sum = 0., normsum = 0.;
+		if(nchan <= 0 or nskip[uvrow] == nchan)
+			continue;
 
-		// Data is in a matrix where columns are different frequencies
-		// and rows are different polarizations.
-		// For weights we only have a vector, ie. only one weight for all frequencies
-		// and the rows represents different polarizations.
-
-		// Looping over frequency.
-		for(int j = 0; j < inVis.nchan; j++)
+		for(int j = 0; j < nchan; j++)
 		{
-			float dd_real = 0., dd_imag = 0.;
-			float weightNorm = 0.;
-			float phase;
-			float freq = float(inVis.freq[j]);
-
-			for(int i_p = 0; i_p < coords->nStackPoints[inVis.fieldID]; i_p++)
-			{
-				phase= -freq*(u*coords->omega_x[inVis.fieldID][i_p]+
-				              v*coords->omega_y[inVis.fieldID][i_p]+
-				              w*coords->omega_z[inVis.fieldID][i_p]);
-
-				float weightbuff = coords->weight[fieldID][i_p];
-				float pbcor = float(pb->calc(coords->dx[fieldID][i_p], coords->dy[fieldID][i_p], freq));
-
-				dd_real += weightbuff*pbcor*cos(phase);
-				dd_imag += weightbuff*pbcor*sin(phase);
-
-// 				dd += Complex(dd_real, dd_imag);
-// 				if(stackingMode == 0)
-// 					dd += Complex(dd_real, dd_imag);
-// 				else
-// 					dd += psf(dd_real, dd_imag, u, v, w, coords->dx[fieldID][i_p], coords->dy[fieldID][i_p], freq);
-
-				weightNorm += pbcor*pbcor*weightbuff;
-			}
-
+			int chan = chan0+j;
+			float weightNorm = pbtable.sumSquares(fieldID, inVis.spw, chan);
 			if(weightNorm != 0)
 			{
-				dd_real /= weightNorm;
-				dd_imag /= weightNorm;
+				re[j] /= weightNorm;
+				im[j] /= weightNorm;
 			}
 			else
 			{
-				dd_real  = 0.;
-				dd_imag  = 0.;
+				re[j] = 0.;
+				im[j] = 0.;
 			}
 
 			// Looping over polarization.
 			// dd does not need to be updated since it does not depend on polarization.
-			for(int i = 0; i < inVis.nstokes; i++)
+			for(int i = 0; i < nstokes; i++)
 			{
-				outVis.data_real[i*outVis.nchan+j] = dd_real*inVis.data_real[i*inVis.nchan+j]
-					                               - dd_imag*inVis.data_imag[i*inVis.nchan+j];
-				outVis.data_imag[i*outVis.nchan+j] = dd_real*inVis.data_imag[i*inVis.nchan+j]
-					                               + dd_imag*inVis.data_real[i*inVis.nchan+j];
-
+				std::complex<float> vis = inVis.data[chan*nstokes+i];
+				std::complex<float> stacked(
+						re[j]*vis.real() - im[j]*vis.imag(),
+						re[j]*vis.imag() + im[j]*vis.real());
 
+				int windex = inVis.nchan*i+chan;
+				float weight = inVis.weight[windex];
 				if(redoWeights)
 					if(weightNorm < 1e30)
-						outVis.weight[i] = float(weightNorm)*inVis.weight[i];
+						weight = weightNorm*inVis.weight[windex];
 					else
-						outVis.weight[i] = float(0.0)*inVis.weight[i];
-				else
-					outVis.weight[i] = inVis.weight[i];
+						weight = float(0.0)*inVis.weight[windex];
+
+				if(store)
+				{
+					outVis.data[chan*nstokes+i] = stacked;
+					outVis.weight[windex] = weight;
+				}
+
+				// Flagged data does not contribute to the flux.
+				if(inVis.data_flag[inVis.nchan*i+chan])
+					continue;
+				sum += stacked.real()*weight;
+				normsum += weight;
+			}
+		}
+
+		if(normsum > 0)
+		{
+			sums[0].add(sum);
+			sums[1].add(normsum);
 
-				sum += outVis.data_real[i*inVis.nchan+j]*outVis.weight[i];
-				normsum += outVis.weight[i];
+			int bin = uvBin(inVis.u, inVis.v);
+			if(bin >= 0)
+			{
+				sums[2+2*bin].add(sum);
+				sums[3+2*bin].add(normsum);
 			}
 		}
+	}
+}/*}}}*/
+
+// Adds weighted sum of stacked visibilities and of weights to sums[0] and 
+// sums[1], and per uv bin to sums[2+2*bin] and sums[3+2*bin].
+void StackChunkComputer::stackChunk(Chunk* chunk, KahanSum* sums) /*{{{*/
+{
+	bool store = not accumulateOnly;
+
+	int npos_max = 0;
+	for(int fieldID = 0; fieldID < coords->nPointings; fieldID++)
+		npos_max = std::max(npos_max, coords->nStackPoints[fieldID]);
+
+	int tile_max = std::min(int(paddedSize(npos_max)), POSITION_TILE);
+	float* k = allocAligned(tile_max);
+	float* work = allocAligned(4*tile_max);
+	// Sums for every visibility and channel in a block.
+	int block = std::min(CHANNEL_BLOCK, int(chunk->nChan()));
+	float* dd_real = new float[chunk->size()*block];
+	float* dd_imag = new float[chunk->size()*block];
+	// Rows of the primary beam table, if it has to interpolate them.
+	float* pbbuffer = pbtable.interpolated() ? 
+	                  allocAligned(size_t(block)*tile_max) : NULL;
+	// Channels in a block where all stokes are flagged, these are not
+	// evaluated when only the sums are kept, and the number of such 
+	// channels for each visibility. Stored output is phase shifted for
+	// flagged data as well, so nothing is skipped then.
+	int* skip = new int[chunk->size()*block];
+	int* nskip = new int[chunk->size()];
+	// Rows where the sums were given by gridPhases.
+	bool* gridded = new bool[chunk->size()];
+	int nstokes = chunk->uniformStokes();
+
+	for(size_t uvrow = 0; store and uvrow < chunk->size(); uvrow++)
+	{
+		Visibility& inVis = chunk->inVis[uvrow];
+		Visibility& outVis = chunk->outVis[uvrow];
 
 		if(coords->nStackPoints[inVis.fieldID] > 0)
 			outVis.fieldID = 0;
@@ -125,13 +210,139 @@ void StackChunkComputer::computeChunk(Chunk* chunk) /*{{{*/
 			outVis.fieldID = 1;
 		outVis.index = inVis.index;
 	}
-    pthread_mutex_lock(&fluxMutex);
-	if( normsum > 0)
-    {
-        sumvisweight += sum;
-        sumweight += normsum;
-    }
-    pthread_mutex_unlock(&fluxMutex);
+
+	// Channels are done in blocks and positions in tiles. Each tile of
+	// the primary beam table is used for all visibilities in the chunk
+	// before moving on, so the working set stays in cache for any 
+	// number of positions.
+	for(int chan0 = 0; chan0 < int(chunk->nChan()); chan0 += CHANNEL_BLOCK)
+	{
+		for(size_t j = 0; j < chunk->size()*block; j++)
+		{
+			dd_real[j] = 0.;
+			dd_imag[j] = 0.;
+		}
+
+		for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
+		{
+			Visibility& inVis = chunk->inVis[uvrow];
+			int nchan = std::min(CHANNEL_BLOCK, inVis.nchan-chan0);
+			nskip[uvrow] = 0;
+			for(int j = 0; j < nchan; j++)
+			{
+				int flagged = store ? 0 : 1;
+				for(int i = 0; flagged and i < inVis.nstokes; i++)
+					flagged &= (inVis.data_flag[inVis.nchan*i+chan0+j] != 0);
+				skip[uvrow*block+j] = flagged;
+				nskip[uvrow] += flagged;
+			}
+
+			gridded[uvrow] = nchan > 0 and nskip[uvrow] < nchan and
+			                 gridPhases(inVis, chan0, nchan, 
+			                            &skip[uvrow*block], 
+			                            &dd_real[uvrow*block], 
+			                            &dd_imag[uvrow*block]);
+		}
+
+		for(int p0 = 0; p0 < int(paddedSize(npos_max)); p0 += POSITION_TILE)
+		{
+			int freq_spw = -1;
+			bool even = false;
+			double freq0 = 0., dfreq = 0.;
+
+			for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
+			{
+				Visibility& inVis = chunk->inVis[uvrow];
+				int fieldID = inVis.fieldID;
+				int npos_padded = int(paddedSize(coords->nStackPoints[fieldID]));
+				int ntile = std::min(POSITION_TILE, npos_padded-p0);
+				int nchan = std::min(CHANNEL_BLOCK, inVis.nchan-chan0);
+				// Rows that are completely flagged are skipped if only the
+				// sums are kept.
+				if(nchan <= 0 or ntile <= 0 or nskip[uvrow] == nchan or
+				   gridded[uvrow])
+					continue;
+
+				if(inVis.spw != freq_spw)
+				{
+					even = evenlySpaced(inVis.freq, inVis.nchan, freq0, dfreq);
+					freq_spw = inVis.spw;
+				}
+
+				// Weight times primary beam from the table computed in 
+				// preCompute.
+				int stride;
+				const float* pbweight = pbtable.block(fieldID, inVis.spw, 
+				                                      chan0, nchan, p0, ntile,
+				                                      pbbuffer, stride);
+				float* re = &dd_real[uvrow*block];
+				float* im = &dd_imag[uvrow*block];
+
+				phaseFactors(inVis.u, inVis.v, inVis.w, 
+				             &coords->omega_x[fieldID][p0], 
+				             &coords->omega_y[fieldID][p0], 
+				             &coords->omega_z[fieldID][p0], ntile, -1., k);
+				if(nskip[uvrow] > 0 and even)
+					sumPhasorSeriesSkip(k, ntile, freq0+chan0*dfreq, dfreq, 
+					                    pbweight, stride, nchan, 
+					                    &skip[uvrow*block], re, im, work);
+				else if(nskip[uvrow] > 0)
+					sumPhasorsSkip(k, ntile, &inVis.freq[chan0], pbweight, 
+					               stride, nchan, &skip[uvrow*block], re, im);
+				else if(even)
+					sumPhasorSeries(k, ntile, freq0+chan0*dfreq, dfreq, 
+					                pbweight, stride, nchan, re, im, work);
+				else
+					sumPhasors(k, ntile, &inVis.freq[chan0], pbweight, 
+					           stride, nchan, re, im);
+			}
+		}
+
+		// Common numbers of correlations get a kernel of their own, where
+		// the loop over correlations is unrolled.
+		switch(nstokes)
+		{
+			case 1:
+				applyPhases<1>(chunk, chan0, dd_real, dd_imag, nskip, sums);
+				break;
+			case 2:
+				applyPhases<2>(chunk, chan0, dd_real, dd_imag, nskip, sums);
+				break;
+			case 4:
+				applyPhases<4>(chunk, chan0, dd_real, dd_imag, nskip, sums);
+				break;
+			default:
+				applyPhases<0>(chunk, chan0, dd_real, dd_imag, nskip, sums);
+		}
+	}
+
+	freeAligned(k);
+	freeAligned(work);
+	freeAligned(pbbuffer);
+	delete[] dd_real;
+	delete[] dd_imag;
+	delete[] skip;
+	delete[] nskip;
+	delete[] gridded;
+}/*}}}*/
+
+bool StackChunkComputer::gridPhases(Visibility&, int, int, const int*, /*{{{*/
+                                    float*, float*)
+{
+	return false;
+}/*}}}*/
+
+int StackChunkComputer::uvBin(float u, float v)/*{{{*/
+{
+	// Same binning as in StackMCChunkComputer,
+	// bin i covers bins[i] <= uvdist < bins[i+1].
+	float uvdist = sqrt(u*u + v*v);
+	for(int i = 0; i < nbin; i++)
+	{
+		if(uvdist >= bins[i] && uvdist < bins[i+1])
+			return i;
+	}
+	return -1;
 }/*}}}*/
 
 void StackChunkComputer::preCompute(DataIO* data)
@@ -144,15 +355,18 @@ void StackChunkComputer::preCompute(DataIO* data)
 	}
 
 
-	pthread_mutex_init(&fluxMutex, NULL);
-    sumvisweight = 0.;
-    sumweight = 0.;
+	reduction.init(n_thread, 2+2*nbin);
 
 	coords->computeCoords(data, *pb);
+	pbtable.compute(data, *pb, coords->nPointings, coords->nStackPoints,
+	                coords->dx, coords->dy, coords->weight);
 }
 
 void StackChunkComputer::postCompute(DataIO* data)
 {
+	if(accumulateOnly)
+		return;
+
 	// After stacking we have all visibilities in field 0.
 	// Set centre to 0., 0. to indicate that coordinates at this point are
 	// arbitrary.
@@ -164,5 +378,21 @@ void StackChunkComputer::postCompute(DataIO* data)
 
 double StackChunkComputer::flux()
 {
-    return sumvisweight/sumweight;
+    return reduction.result(0)/reduction.result(1);
+}
+
+double StackChunkComputer::weight()
+{
+	return reduction.result(1);
+}
+
+void StackChunkComputer::profile(double* flux, double* weight)
+{
+	for(int bin = 0; bin < nbin; bin++)
+	{
+		double sumvisweight = reduction.result(2+2*bin);
+		double sumweight = reduction.result(3+2*bin);
+		weight[bin] = sumweight;
+		flux[bin] = sumweight > 0. ? sumvisweight/sumweight : 0.;
+	}
 }
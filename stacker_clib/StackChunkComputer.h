@@ -20,6 +20,7 @@
 #include "MSComputer.h"
 #include "Coords.h"
 #include "PrimaryBeam.h"
+#include "PrimaryBeamTable.h"
 #include "DataIO.h"
 #include <pthread.h>
 
@@ -30,26 +31,65 @@
 class StackChunkComputer: public ChunkComputer
 {
 	private:
-		Coords* coords;
-		PrimaryBeam* pb;
 		int stackingMode;
 		bool redoWeights;
-        double sumvisweight, sumweight;
+		bool accumulateOnly;
+
+		// Edges of uv-distance bins for the profile, in metres.
+		int nbin;
+		float* bins;
 
-		pthread_mutex_t fluxMutex;
+		void stackChunk(Chunk* chunk, KahanSum* sums);
+		template<int NSTOKES>
+		void applyPhases(Chunk* chunk, int chan0, float* dd_real, 
+		                 float* dd_imag, const int* nskip, KahanSum* sums);
+		int uvBin(float u, float v);
+
+	protected:
+		Coords* coords;
+		PrimaryBeam* pb;
+		PrimaryBeamTable pbtable;
+
+		// Sets re and im to the weighted sum of phase factors over all
+		// positions for channels chan0 to chan0+nchan of vis, except where
+		// skip is set. Returns false if the sums should be computed 
+		// directly instead, which is always the case here.
+		virtual bool gridPhases(Visibility& vis, int chan0, int nchan,
+		                        const int* skip, float* re, float* im);
 
 	public:
 		void setStackingMode(int mode);
+		// Scale visibility weights with the sum of squares of the primary
+		// beam also for data with a single field. Needed to combine flux
+		// and weight of several data sets.
+		void setRedoWeights(bool redo);
 		StackChunkComputer(Coords* coords, PrimaryBeam* pb);
+		~StackChunkComputer();
+
+		// Only accumulate flux and profile, stacked visibilities 
+		// are not stored and nothing is written.
+		void setAccumulateOnly(bool accumulate);
+		// Accumulate a profile in nbin uv-distance bins, edges in bins
+		// (nbin+1 values). Must be called before preCompute.
+		void setProfileBins(double* bins, int nbin);
 
 		// Called from computer and allows to access data,
 		// unlike normal constructor which is called before computer
 		// is created.
 		void preCompute(DataIO* ms);
 		virtual void computeChunk(Chunk* chunk);
+		virtual void computeChunk(Chunk* chunk, int thread);
 		void postCompute(DataIO* ms);
 
+		int dataLayout() { return Chunk::layout_interleaved; };
+		bool writesOutput() { return not accumulateOnly; };
+
         double flux();
+		// Sum of weights of the visibilities averaged in flux.
+		double weight();
+		// Weighted mean of the real part of stacked visibilities and sum
+		// of weights in each uv bin.
+		void profile(double* flux, double* weight);
 };
 
 #endif // inclusion guard
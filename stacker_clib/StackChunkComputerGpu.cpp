@@ -73,7 +73,7 @@ void StackChunkComputerGpu::preCompute(DataIO* dataio)/*{{{*/
 		if(coords->nStackPoints[i] > nmaxcoords)
 			nmaxcoords = coords->nStackPoints[i];
 
-	allocate_cuda_data(dev_data, dataio->nChan(), dataio->nStokes(), CHUNK_SIZE);
+	allocate_cuda_data(dev_data, dataio->nChan(), dataio->nStokes(), max_chunk_size);
 	allocate_cuda_data_stack(dev_coords, dataio->nChan(),
 	                         nmaxcoords, dataio->nSpw());
 
@@ -92,6 +92,8 @@ __global__ void cuVisStack(DataContainer data, CoordContainer coords, /*{{{*/
 
 				data.data_real[dataindex] = data_real_buff;
 				data.data_imag[dataindex] = data_imag_buff;
+				// Weights are per channel, with the same index as data.
+				data.data_weight[dataindex] *= norm;
             }
         }
 
@@ -99,12 +101,6 @@ __global__ void cuVisStack(DataContainer data, CoordContainer coords, /*{{{*/
 		m_imag_avg /= (float)nchan;
 		norm_avg /= (float)nchan;
 
-		for(size_t stokesID = 0; stokesID < nstokes; stokesID++)
-		{
-			size_t weightindex = uvrow*nstokes+stokesID;
-			data.data_weight[weightindex] *= norm_avg;
-		}
-
         uvrow += blockDim.x*gridDim.x;
     }
 };/*}}}*/
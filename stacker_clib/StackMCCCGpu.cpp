@@ -93,7 +93,7 @@ void StackMCCCGpu::preCompute(DataIO* dataio)/*{{{*/
 	}
 
 	allocate_cuda_data(dev_data, dataio->nChan(), 
-	                   dataio->nStokes(), CHUNK_SIZE);
+	                   dataio->nStokes(), max_chunk_size);
 	allocate_cuda_data_stack(dev_coords, dataio->nChan(),
 							 nmax_coords, dataio->nSpw());
 	allocate_cuda_data_stack_mc(dev_results, bins, nbin);
@@ -91,8 +91,8 @@ __global__ void cu_compute_results_stack_mc(MCResultContainer results, DataConta
 				if(!data.data_flag[dataindex])
 				{
 					weighteddata += data.data_real[dataindex]*
-									data.data_weight[weightindex];
-					weight += data.data_weight[weightindex];
+									data.data_weight[dataindex];
+					weight += data.data_weight[dataindex];
 				}
 // 				weighteddata += data.data_real[dataindex]*
 // 								data.data_weight[weightindex];
@@ -0,0 +1,375 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <iostream>
+#include <algorithm>
+
+#include "StackMCChunkComputer.h"
+#include "Chunk.h"
+#include "Coords.h"
+#include "Model.h"
+#include "ModelKernels.h"
+#include "PrimaryBeam.h"
+#include "PhaseRotation.h"
+#include "FastMath.h"
+
+StackMCChunkComputer::StackMCChunkComputer(Coords** coordlists, Model** models,/*{{{*/
+                                           PrimaryBeam* pb, 
+                                           int nmc, double* bins, int nbin)
+{
+	this->coords = coordlists;
+	this->models = models;
+	this->pb = pb;
+	this->nmc = nmc;
+	this->nbin = nbin;
+	redoWeights = false;
+	coordTables = new PrimaryBeamTable[nmc];
+	modelTables = new PrimaryBeamTable[nmc];
+
+	this->bins = new float[nbin+1];
+	for(int i = 0; i < nbin+1; i++)
+		this->bins[i] = (float)bins[i];
+
+	res_flux = new double[nmc*nbin];
+	res_weight = new double[nmc*nbin];
+	for(int i = 0; i < nbin*nmc; i++)
+	{
+		res_flux[i] = 0.;
+		res_weight[i] = 0.;
+	}
+}/*}}}*/
+StackMCChunkComputer::~StackMCChunkComputer()/*{{{*/
+{
+	delete[] bins;
+	delete[] res_flux;
+	delete[] res_weight;
+	delete[] coordTables;
+	delete[] modelTables;
+}/*}}}*/
+void StackMCChunkComputer::computeChunk(Chunk* chunk, int thread) /*{{{*/
+{
+	KahanSum* sums = reduction.sums(thread);
+	double* flux = new double[nmc*nbin];
+	double* weight = new double[nmc*nbin];
+
+	stackChunk(chunk, flux, weight);
+	for(int i = 0; i < nmc*nbin; i++)
+	{
+		sums[2*i].add(flux[i]);
+		sums[2*i+1].add(weight[i]);
+	}
+
+	delete[] flux;
+	delete[] weight;
+}/*}}}*/
+void StackMCChunkComputer::computeChunk(Chunk* chunk) /*{{{*/
+{
+	KahanSum* sums = new KahanSum[2*nmc*nbin];
+	double* flux = new double[nmc*nbin];
+	double* weight = new double[nmc*nbin];
+
+	stackChunk(chunk, flux, weight);
+	for(int i = 0; i < nmc*nbin; i++)
+	{
+		sums[2*i].add(flux[i]);
+		sums[2*i+1].add(weight[i]);
+	}
+	reduction.addShared(sums);
+
+	delete[] sums;
+	delete[] flux;
+	delete[] weight;
+}/*}}}*/
+// Results are summed locally for the chunk into flux and weight,
+// and only added to the thread sums at the end.
+void StackMCChunkComputer::stackChunk(Chunk* chunk, double* flux, /*{{{*/
+                                      double* weight)
+{
+	for(int i = 0; i < nmc*nbin; i++)
+	{
+		flux[i] = 0.;
+		weight[i] = 0.;
+	}
+
+	int npos_max = 0;
+	for(int i_mc = 0; i_mc < nmc; i_mc++)
+	{
+		for(int fieldID = 0; fieldID < coords[i_mc]->nPointings; fieldID++)
+			npos_max = std::max(npos_max, coords[i_mc]->nStackPoints[fieldID]);
+		for(int fieldID = 0; models[i_mc] != NULL and 
+		    fieldID < models[i_mc]->nPointings; fieldID++)
+			npos_max = std::max(npos_max, models[i_mc]->nStackPoints[fieldID]);
+	}
+
+	int tile_max = std::min(int(paddedSize(npos_max)), POSITION_TILE);
+	float* k = allocAligned(tile_max);
+	float* extent = allocAligned(tile_max);
+	float* work = allocAligned(4*tile_max);
+	float* pbbuffer = allocAligned(size_t(CHANNEL_BLOCK)*tile_max);
+	float* dd_real = new float[CHANNEL_BLOCK];
+	float* dd_imag = new float[CHANNEL_BLOCK];
+	float* model_real = new float[CHANNEL_BLOCK];
+	float* model_imag = new float[CHANNEL_BLOCK];
+	int* skip = new int[CHANNEL_BLOCK];
+
+	for(size_t uvrow = 0; uvrow < chunk->size(); uvrow++)
+	{
+		// Shorthands to make code more readable.
+		Visibility& inVis = chunk->inVis[uvrow];
+		float &u = inVis.u;
+		float &v = inVis.v;
+		float &w = inVis.w;
+		int fieldID = inVis.fieldID;
+
+		// Same binning as in cu_compute_results_stack_mc,
+		// bin i covers bins[i] <= uvdist < bins[i+1].
+		int uvbin = 0;
+		float uv2 = u*u + v*v;
+		float uvdist = sqrt(uv2);
+		for(int i = 0; i < nbin+1; i++)
+		{
+			if(uvdist < bins[i])
+			{
+				uvbin = i;
+				break;
+			}
+		}
+
+		// Visibility outside of all bins does not contribute to any result.
+		if(uvbin <= 0 || uvbin > nbin)
+			continue;
+		uvbin -= 1;
+
+		double freq0 = 0., dfreq = 0.;
+		bool even = evenlySpaced(inVis.freq, inVis.nchan, freq0, dfreq);
+
+		for(int chan0 = 0; chan0 < inVis.nchan; chan0 += CHANNEL_BLOCK)
+		{
+			int nchan = std::min(CHANNEL_BLOCK, inVis.nchan-chan0);
+
+			// Only first polarization is used, as on gpu.
+			int nskip = 0;
+			for(int j = 0; j < nchan; j++)
+			{
+				skip[j] = inVis.data_flag[chan0+j] ? 1 : 0;
+				nskip += skip[j];
+			}
+			if(nskip == nchan)
+				continue;
+
+			for(int i_mc = 0; i_mc < nmc; i_mc++)
+			{
+				Coords* coordlist = coords[i_mc];
+				Model* model = models[i_mc];
+
+				for(int j = 0; j < nchan; j++)
+				{
+					dd_real[j] = 0.;
+					dd_imag[j] = 0.;
+					model_real[j] = 0.;
+					model_imag[j] = 0.;
+				}
+
+				// Weight times primary beam from the tables computed in 
+				// preCompute.
+				PrimaryBeamTable& pbweight = coordTables[i_mc];
+				int npos_padded = int(paddedSize(coordlist->nStackPoints[fieldID]));
+				for(int p0 = 0; p0 < npos_padded; p0 += POSITION_TILE)
+				{
+					int ntile = std::min(POSITION_TILE, npos_padded-p0);
+					int stride;
+					const float* amp = pbweight.block(fieldID, inVis.spw, 
+					                                  chan0, nchan, p0, ntile,
+					                                  pbbuffer, stride);
+					phaseFactors(u, v, w, &coordlist->omega_x[fieldID][p0], 
+					             &coordlist->omega_y[fieldID][p0], 
+					             &coordlist->omega_z[fieldID][p0], 
+					             ntile, -1., k);
+					if(even)
+						sumPhasorSeriesSkip(k, ntile, freq0+chan0*dfreq, dfreq,
+						                    amp, stride, nchan, skip, 
+						                    dd_real, dd_imag, work);
+					else
+						sumPhasorsSkip(k, ntile, &inVis.freq[chan0], amp, 
+						               stride, nchan, skip, dd_real, dd_imag);
+				}
+
+				// Add model for this sample, models are created with 
+				// subtract = false, i.e., fluxes are negative.
+				if(model != NULL)
+					modelVisibility(model, modelTables[i_mc], inVis, chan0, 
+					                nchan, skip, uv2, uvdist, k, extent,
+					                pbbuffer, model_real, model_imag);
+
+				for(int j = 0; j < nchan; j++)
+				{
+					int chan = chan0+j;
+					if(skip[j])
+						continue;
+
+					float weightNorm = pbweight.sumSquares(fieldID, inVis.spw, 
+					                                       chan);
+					if(weightNorm == 0)
+						continue;
+
+					float data_real = inVis.data[chan*inVis.nstokes].real()
+					                - model_real[j];
+					float data_imag = inVis.data[chan*inVis.nstokes].imag()
+					                - model_imag[j];
+					float re = dd_real[j]/weightNorm;
+					float im = dd_imag[j]/weightNorm;
+
+					float visweight = inVis.weight[chan];
+					if(redoWeights)
+					{
+						if(weightNorm < 1e30)
+							visweight *= weightNorm;
+						else
+							visweight = 0.;
+					}
+
+					float stacked_real = re*data_real - im*data_imag;
+					flux[i_mc*nbin+uvbin] += stacked_real*visweight;
+					weight[i_mc*nbin+uvbin] += visweight;
+				}
+			}
+		}
+	}
+
+	freeAligned(k);
+	freeAligned(extent);
+	freeAligned(work);
+	freeAligned(pbbuffer);
+	delete[] dd_real;
+	delete[] dd_imag;
+	delete[] model_real;
+	delete[] model_imag;
+	delete[] skip;
+}/*}}}*/
+// Adds the model of inVis for channels chan0 to chan0+nchan-1 that are 
+// not skipped to model_real and model_imag, as in 
+// ModsubChunkComputer::subtractModel.
+void StackMCChunkComputer::modelVisibility(Model* model, /*{{{*/
+                                           PrimaryBeamTable& fluxpb,
+                                           Visibility& inVis, int chan0, 
+                                           int nchan, const int* skip,
+                                           float uv2, float uvdist, 
+                                           float* k, float* extent, 
+                                           float* pbbuffer,
+                                           float* model_real, 
+                                           float* model_imag)
+{
+	int fieldID = inVis.fieldID;
+	int npos = model->nStackPoints[fieldID];
+	int npos_padded = int(paddedSize(npos));
+	const int* shapeStart = model->shapeStart[fieldID];
+
+	for(int p0 = 0; p0 < npos_padded; p0 += POSITION_TILE)
+	{
+		int ntile = std::min(POSITION_TILE, npos_padded-p0);
+		int stride;
+		const float* amp = fluxpb.block(fieldID, inVis.spw, chan0, nchan, 
+		                                p0, ntile, pbbuffer, stride);
+		phaseFactors(inVis.u, inVis.v, inVis.w, &model->omega_x[fieldID][p0],
+		             &model->omega_y[fieldID][p0], 
+		             &model->omega_z[fieldID][p0], ntile, 1., k);
+
+		const float* omega_size = &model->omega_size[fieldID][p0];
+		int begin[mod_nshape], end[mod_nshape];
+		for(int shape = 0; shape < mod_nshape; shape++)
+		{
+			begin[shape] = std::max(shapeStart[shape]-p0, 0);
+			end[shape] = std::min(shapeStart[shape+1]-p0, ntile);
+		}
+		// Padding has zero flux, including it lets the point kernel run 
+		// on whole vectors.
+		if(shapeStart[mod_point+1] == npos)
+			end[mod_point] = ntile;
+
+		for(int j = 0; j < nchan; j++)
+		{
+			if(skip[j])
+				continue;
+
+			float freq = float(inVis.freq[chan0+j]);
+			sumComponents<mod_point>(k, omega_size, &amp[j*stride], 
+			        begin[mod_point], end[mod_point], freq, uv2, uvdist, 
+			        extent, model_real[j], model_imag[j]);
+			sumComponents<mod_gaussian>(k, omega_size, &amp[j*stride], 
+			        begin[mod_gaussian], end[mod_gaussian], freq, uv2, 
+			        uvdist, extent, model_real[j], model_imag[j]);
+			sumComponents<mod_disk>(k, omega_size, &amp[j*stride], 
+			        begin[mod_disk], end[mod_disk], freq, uv2, uvdist, 
+			        extent, model_real[j], model_imag[j]);
+		}
+	}
+}/*}}}*/
+void StackMCChunkComputer::preCompute(DataIO* dataio)/*{{{*/
+{
+	// If we only have one field in the data the weights do not need to be 
+	// updated. 
+	if(dataio->nPointings() > 1)
+	{
+		redoWeights = true;
+	}
+
+	reduction.init(n_thread, 2*nmc*nbin);
+
+	// Primary beam times weight or flux for every realisation, so that 
+	// stackChunk does not call the primary beam for every visibility.
+	for(int i = 0; i < nmc; i++)
+	{
+		coords[i]->computeCoords(dataio, *pb);
+		coordTables[i].compute(dataio, *pb, coords[i]->nPointings, 
+		                       coords[i]->nStackPoints, coords[i]->dx, 
+		                       coords[i]->dy, coords[i]->weight);
+		if(models[i] != NULL)
+		{
+			models[i]->compute(dataio, pb);
+			modelTables[i].compute(dataio, *pb, models[i]->nPointings, 
+			                       models[i]->nStackPoints, models[i]->dx,
+			                       models[i]->dy, models[i]->flux);
+		}
+	}
+}/*}}}*/
+void StackMCChunkComputer::postCompute(DataIO* data)/*{{{*/
+{
+	for(int i = 0; i < nmc*nbin; i++)
+	{
+		res_flux[i] = reduction.result(2*i);
+		res_weight[i] = reduction.result(2*i+1);
+	}
+}/*}}}*/
+double* StackMCChunkComputer::get_flux()/*{{{*/
+{
+	double* ret = new double[nmc*nbin];
+	for(int i = 0; i < nmc*nbin; i++)
+	{
+		ret[i] = res_flux[i];
+	}
+	return ret;
+}/*}}}*/
+double* StackMCChunkComputer::get_weight()/*{{{*/
+{
+	double* ret = new double[nmc*nbin];
+	for(int i = 0; i < nmc*nbin; i++)
+	{
+		ret[i] = res_weight[i];
+	}
+	return ret;
+}/*}}}*/
@@ -0,0 +1,79 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include "MSComputer.h"
+#include "Coords.h"
+#include "Model.h"
+#include "PrimaryBeam.h"
+#include "PrimaryBeamTable.h"
+#include "DataIO.h"
+#include <pthread.h>
+
+#ifndef __STACK_MC_CHUNK_COMPUTER_H__
+#define __STACK_MC_CHUNK_COMPUTER_H__
+
+// Cpu version of StackMCCCGpu.
+// Stacks all nmc coordinate lists (with optional models added) for each chunk
+// and bins the stacked visibilities in uv distance, the data is only read
+// once regardless of the number of Monte-Carlo samples.
+class StackMCChunkComputer: public ChunkComputer
+{
+	private:
+		Coords** coords;
+		Model** models;
+		PrimaryBeam* pb;
+		// Primary beam times weight of each coordinate list and times 
+		// flux of each model.
+		PrimaryBeamTable* coordTables;
+		PrimaryBeamTable* modelTables;
+
+		int nbin;
+		int nmc;
+		float* bins;
+		double* res_flux;
+		double* res_weight;
+
+		bool redoWeights;
+
+		void stackChunk(Chunk* chunk, double* flux, double* weight);
+		void modelVisibility(Model* model, PrimaryBeamTable& fluxpb,
+		                     Visibility& inVis, int chan0, int nchan, 
+		                     const int* skip, float uv2, float uvdist,
+		                     float* k, float* extent, float* pbbuffer,
+		                     float* model_real, float* model_imag);
+
+	public:
+		StackMCChunkComputer(Coords** coords, Model** models, PrimaryBeam* pb, 
+		                     int nmc, double* bins, int nbin);
+		~StackMCChunkComputer();
+
+		// Called from computer and allows to access data,
+		// unlike normal constructor which is called before computer
+		// is created.
+		void preCompute(DataIO* ms);
+		virtual void computeChunk(Chunk* chunk);
+		virtual void computeChunk(Chunk* chunk, int thread);
+		void postCompute(DataIO* ms);
+
+		int dataLayout() { return Chunk::layout_interleaved; };
+
+		double* get_flux();
+		double* get_weight();
+};
+
+#endif // inclusion guard
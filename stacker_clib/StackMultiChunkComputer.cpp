@@ -0,0 +1,101 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+#include "StackMultiChunkComputer.h"
+#include "Chunk.h"
+
+StackMultiChunkComputer::StackMultiChunkComputer(Coords** coords, /*{{{*/
+                                                 PrimaryBeam* pb,
+                                                 DataIO** outputs, int ntarget)
+{
+	this->outputs = outputs;
+	this->ntarget = ntarget;
+
+	stackers = new StackChunkComputer*[ntarget];
+	for(int i = 0; i < ntarget; i++)
+	{
+		stackers[i] = new StackChunkComputer(coords[i], pb);
+		stackers[i]->setAccumulateOnly(outputs[i] == NULL);
+	}
+}/*}}}*/
+
+StackMultiChunkComputer::~StackMultiChunkComputer()/*{{{*/
+{
+	for(int i = 0; i < ntarget; i++)
+		delete stackers[i];
+	delete[] stackers;
+}/*}}}*/
+
+void StackMultiChunkComputer::computeChunk(Chunk* chunk) /*{{{*/
+{
+	// outVis is only scratch space here, every list overwrites it from 
+	// inVis and it is written out before the next list is stacked.
+	for(int i = 0; i < ntarget; i++)
+	{
+		stackers[i]->computeChunk(chunk);
+
+		// msio serialises all casacore calls with one lock.
+		if(outputs[i] != NULL)
+			outputs[i]->writeChunk(*chunk);
+	}
+}/*}}}*/
+
+void StackMultiChunkComputer::computeChunk(Chunk* chunk, int thread) /*{{{*/
+{
+	for(int i = 0; i < ntarget; i++)
+	{
+		stackers[i]->computeChunk(chunk, thread);
+
+		if(outputs[i] != NULL)
+			outputs[i]->writeChunk(*chunk);
+	}
+}/*}}}*/
+
+bool StackMultiChunkComputer::writesOutput()/*{{{*/
+{
+	for(int i = 0; i < ntarget; i++)
+	{
+		if(outputs[i] != NULL)
+			return true;
+	}
+	return false;
+}/*}}}*/
+
+void StackMultiChunkComputer::preCompute(DataIO* data)/*{{{*/
+{
+	for(int i = 0; i < ntarget; i++)
+	{
+		stackers[i]->setMaxChunkSize(max_chunk_size);
+		stackers[i]->setNThread(n_thread);
+		stackers[i]->preCompute(data);
+	}
+}/*}}}*/
+
+void StackMultiChunkComputer::postCompute(DataIO* data)/*{{{*/
+{
+	for(int i = 0; i < ntarget; i++)
+	{
+		stackers[i]->mergeReduction();
+		if(outputs[i] != NULL)
+			stackers[i]->postCompute(outputs[i]);
+	}
+}/*}}}*/
+
+double StackMultiChunkComputer::flux(int target)/*{{{*/
+{
+	return stackers[target]->flux();
+}/*}}}*/
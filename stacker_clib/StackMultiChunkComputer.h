@@ -0,0 +1,59 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+#include "MSComputer.h"
+#include "Coords.h"
+#include "PrimaryBeam.h"
+#include "StackChunkComputer.h"
+#include "DataIO.h"
+
+#ifndef __STACK_MULTI_CHUNK_COMPUTER_H__
+#define __STACK_MULTI_CHUNK_COMPUTER_H__
+
+// Stacks ntarget independent coordinate lists in one pass over the data.
+// Each chunk is read once and stacked on every list in turn, the stacked
+// visibilities of list i are written to outputs[i] directly from the
+// computer threads. Outputs are msio, which takes the process-wide 
+// casacore lock on every write. outputs[i] can be NULL to only 
+// calculate the flux.
+// The main output of the MSComputer is not used.
+class StackMultiChunkComputer: public ChunkComputer
+{
+	private:
+		StackChunkComputer** stackers;
+		DataIO** outputs;
+		int ntarget;
+
+	public:
+		StackMultiChunkComputer(Coords** coords, PrimaryBeam* pb, 
+		                        DataIO** outputs, int ntarget);
+		~StackMultiChunkComputer();
+
+		void preCompute(DataIO* ms);
+		virtual void computeChunk(Chunk* chunk);
+		virtual void computeChunk(Chunk* chunk, int thread);
+		void postCompute(DataIO* ms);
+
+		int dataLayout() { return Chunk::layout_interleaved; };
+		// Outputs are written here and not by the MSComputer, but chunks 
+		// still need output buffers if any target is written.
+		bool writesOutput();
+
+		double flux(int target);
+};
+
+#endif // inclusion guard
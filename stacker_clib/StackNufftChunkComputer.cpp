@@ -0,0 +1,223 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+#include "StackNufftChunkComputer.h"
+#include "definitions.h"
+
+using std::cout;
+using std::endl;
+
+StackNufftChunkComputer::StackNufftChunkComputer(Coords* coords, /*{{{*/
+                                                 PrimaryBeam* pb,
+                                                 double tolerance,
+                                                 double cell, int size)
+	: StackChunkComputer(coords, pb)
+{
+	this->tolerance = tolerance > 0. ? tolerance : NUFFT_DEFAULT_TOLERANCE;
+	kernel = new GridKernel(GridKernel::widthFor(this->tolerance));
+	requestedCell = cell;
+	requestedSize = std::max(size, 0);
+	if(requestedSize > 0 and not isPowerOfTwo(requestedSize))
+	{
+		cout << "Grid size " << requestedSize << " is not a power of two, "
+		     << "using " << nextPowerOfTwo(requestedSize) << "." << endl;
+		requestedSize = nextPowerOfTwo(requestedSize);
+	}
+
+	nfields = 0;
+	nspw = 0;
+	spwMaxFreq = NULL;
+	grids = NULL;
+	samplesGridded = 0;
+	samplesDirect = 0;
+	pthread_mutex_init(&countMutex, NULL);
+}/*}}}*/
+
+StackNufftChunkComputer::~StackNufftChunkComputer()/*{{{*/
+{
+	freeGrids();
+	delete kernel;
+	pthread_mutex_destroy(&countMutex);
+}/*}}}*/
+
+void StackNufftChunkComputer::freeGrids()/*{{{*/
+{
+	for(int i = 0; grids != NULL and i < nfields*nspw; i++)
+		delete grids[i];
+	delete[] grids;
+	delete[] spwMaxFreq;
+	grids = NULL;
+	spwMaxFreq = NULL;
+	nfields = 0;
+	nspw = 0;
+}/*}}}*/
+
+void StackNufftChunkComputer::preCompute(DataIO* ms)/*{{{*/
+{
+	StackChunkComputer::preCompute(ms);
+	freeGrids();
+	samplesGridded = 0;
+	samplesDirect = 0;
+
+	nfields = coords->nPointings;
+	nspw = int(ms->nSpw());
+	int nchan = int(ms->nChan());
+
+	spwMaxFreq = new float[nspw];
+	float maxFreq = 0.;
+	for(int spw = 0; spw < nspw; spw++)
+	{
+		float* freq = ms->getFreq(spw);
+		spwMaxFreq[spw] = *std::max_element(freq, &freq[nchan]);
+		maxFreq = std::max(maxFreq, spwMaxFreq[spw]);
+	}
+
+	// Grids are made large enough for the longest baseline if memory
+	// allows.
+	double uvMax = ms->maxBaseline()*maxFreq/c;
+	if(uvMax <= 0. and requestedSize <= 0)
+		cout << "uv coverage of the data is not known, using grids of up to "
+		     << GRID_DEFAULT_SIZE << " cells." << endl;
+
+	grids = new ChannelGrids*[nfields*nspw];
+	for(int i = 0; i < nfields*nspw; i++)
+		grids[i] = NULL;
+
+#ifdef _SC_AVPHYS_PAGES
+	double memory = double(sysconf(_SC_AVPHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#else
+	double memory = double(sysconf(_SC_PHYS_PAGES))*double(sysconf(_SC_PAGESIZE));
+#endif
+	memory *= GRID_MEMORY_FRACTION;
+
+	int totalGridded = 0, totalPositions = 0, fieldsGridded = 0, largest = 0;
+	double used = 0.;
+	int* ngrid = new int[nspw];
+	for(int fieldID = 0; fieldID < nfields; fieldID++)
+	{
+		int npos = coords->nStackPoints[fieldID];
+		totalPositions += npos;
+		if(npos < GRID_MIN_COMPONENTS)
+			continue;
+
+		double maxOffset = 0., maxW = 0.;
+		for(int i = 0; i < npos; i++)
+		{
+			double l = double(coords->omega_x[fieldID][i])*c/(2*M_PI);
+			double m = double(coords->omega_y[fieldID][i])*c/(2*M_PI);
+			double w = double(coords->omega_z[fieldID][i])*c/(2*M_PI);
+			maxOffset = std::max(maxOffset, std::max(std::abs(l), std::abs(m)));
+			maxW = std::max(maxW, std::abs(w));
+		}
+
+		int ngridTotal = 0;
+		for(int spw = 0; spw < nspw; spw++)
+		{
+			ngrid[spw] = ChannelGrids::count(pbtable, fieldID, spw, npos, 
+			                                 ms->getFreq(spw), nchan, 
+			                                 tolerance);
+			ngridTotal += ngrid[spw];
+		}
+
+		int n, nw;
+		double cell, wLimit, bytes;
+		if(not UVGrid::layout(maxOffset, maxW, uvMax, tolerance, ngridTotal,
+		                      memory-used, kernel, requestedSize, 
+		                      requestedCell, n, cell, nw, wLimit, bytes))
+		{
+			cout << "Positions of field " << fieldID << " do not fit in "
+			     << "a grid in memory, using direct sum." << endl;
+			continue;
+		}
+		used += bytes;
+
+		for(int spw = 0; spw < nspw; spw++)
+		{
+			grids[fieldID*nspw+spw] = new ChannelGrids(kernel, n, cell, nw, 
+			                                           wLimit, -1, ngrid[spw],
+			                                           pbtable, fieldID, spw,
+			                                           npos, ms->getFreq(spw), 
+			                                           nchan,
+			                                           coords->omega_x[fieldID],
+			                                           coords->omega_y[fieldID],
+			                                           coords->omega_z[fieldID]);
+		}
+		totalGridded += npos;
+		fieldsGridded++;
+		largest = std::max(largest, n);
+	}
+	delete[] ngrid;
+
+	cout << "Gridded " << totalGridded << " of " << totalPositions 
+	     << " positions in " << fieldsGridded << " fields on grids of up to "
+	     << largest << " cells with kernel width " << kernel->support() 
+	     << ", using " << used/1024./1024. << " MB." << endl;
+}/*}}}*/
+
+bool StackNufftChunkComputer::gridPhases(Visibility& vis, int chan0, /*{{{*/
+                                         int nchan, const int* skip, 
+                                         float* re, float* im)
+{
+	size_t nsamples = 0;
+	for(int j = 0; j < nchan; j++)
+		nsamples += skip[j] ? 0 : 1;
+
+	ChannelGrids* grid = grids[vis.fieldID*nspw+vis.spw];
+	double maxScale = spwMaxFreq[vis.spw]/c;
+	bool inside = grid != NULL and
+	              std::abs(vis.u*maxScale) <= grid->uvLimit() and 
+	              std::abs(vis.v*maxScale) <= grid->uvLimit() and
+	              std::abs(vis.w*maxScale) <= grid->wLimit();
+
+	pthread_mutex_lock(&countMutex);
+	if(inside)
+		samplesGridded += nsamples;
+	else
+		samplesDirect += nsamples;
+	pthread_mutex_unlock(&countMutex);
+
+	if(not inside)
+		return false;
+
+	for(int j = 0; j < nchan; j++)
+	{
+		if(skip[j])
+			continue;
+
+		int chan = chan0+j;
+		double scale = vis.freq[chan]/c;
+		std::complex<float> sum = (*grid)(vis.u*scale, vis.v*scale, 
+		                                  vis.w*scale, chan, vis.freq);
+		re[j] = sum.real();
+		im[j] = sum.imag();
+	}
+	return true;
+}/*}}}*/
+
+void StackNufftChunkComputer::postCompute(DataIO* ms)/*{{{*/
+{
+	StackChunkComputer::postCompute(ms);
+	cout << "Phases of " << samplesGridded << " of " 
+	     << samplesGridded+samplesDirect << " visibilities interpolated "
+	     << "from grids, " << samplesDirect << " summed directly." << endl;
+}/*}}}*/
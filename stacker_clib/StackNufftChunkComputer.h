@@ -0,0 +1,90 @@
+// stacker, Python module for stacking of interferometric data.
+// Copyright (C) 2014  Lukas Lindroos
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA. 
+//
+// Library to stack and modsub ms data.
+
+#include <pthread.h>
+
+#include "StackChunkComputer.h"
+#include "Gridding.h"
+#include "Coords.h"
+#include "PrimaryBeam.h"
+#include "DataIO.h"
+
+#ifndef __STACK_NUFFT_CHUNK_COMPUTER_H__
+#define __STACK_NUFFT_CHUNK_COMPUTER_H__
+
+// Stacking where the phase factors of all positions are interpolated from
+// a uv grid, a non-uniform fft, see UVGrid.
+//
+// For each field and spectral window the positions are spread onto an
+// image with amplitudes weight times primary beam, which is Fourier 
+// transformed once in preCompute. Run time then grows with the number of
+// positions plus the number of visibilities, rather than their product.
+// To follow the primary beam, grids are made for a few channels in each
+// window, as many as needed for linear interpolation in frequency between
+// them to stay within the tolerance.
+//
+// Fields with few positions, fields whose positions do not fit in the 
+// image, and visibilities outside the grid, are stacked with the direct
+// sum of StackChunkComputer.
+class StackNufftChunkComputer: public StackChunkComputer
+{
+	private:
+		GridKernel* kernel;
+		double tolerance;
+		double requestedCell;
+		int requestedSize;
+
+		int nfields, nspw;
+		float* spwMaxFreq;
+
+		// Grids for [field*nspw+spw], NULL where the direct sum is used.
+		ChannelGrids** grids;
+
+		// Channels of rows interpolated from grids and channels summed
+		// directly, for the summary in postCompute.
+		size_t samplesGridded, samplesDirect;
+		pthread_mutex_t countMutex;
+
+		// Releases the grids of the last preCompute.
+		void freeGrids();
+
+	protected:
+		bool gridPhases(Visibility& vis, int chan0, int nchan,
+		                const int* skip, float* re, float* im);
+
+	public:
+		// tolerance is the largest relative error of the phase sums, 
+		// NUFFT_DEFAULT_TOLERANCE if 0 or less. cell and size are the
+		// pixel size in radians and the number of pixels of the image
+		// along each axis. If 0 or less they are chosen for each field
+		// so that the image holds its positions and the grid reaches the
+		// longest baseline of the data, within GRID_MEMORY_FRACTION of 
+		// the free memory, see UVGrid::layout. Visibilities with |u| or
+		// |v| above 1/(2*GRID_PADDING*cell) wavelengths use the direct 
+		// sum.
+		StackNufftChunkComputer(Coords* coords, PrimaryBeam* pb, 
+		                        double tolerance = 0., 
+		                        double cell = 0., int size = 0);
+		~StackNufftChunkComputer();
+
+		void preCompute(DataIO* ms);
+		void postCompute(DataIO* ms);
+};
+
+#endif // inclusion guard
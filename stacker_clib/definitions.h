@@ -27,8 +27,48 @@ const double tol = 1e-9;
 const int N_THREAD = 24;
 const int N_CHUNK = 2*N_THREAD;
 const int CHUNK_SIZE = 10000;
-const size_t N_MAX_COORDS = 4000;
-const size_t N_MAX_MOD_COMP = 3000;
+// Used when thread count, chunk count or chunk size is set to auto (<= 0).
+const size_t AUTO_CHUNK_BYTES = 16*1024*1024;
+const double AUTO_MEMORY_FRACTION = 0.25;
+const int MIN_CHUNK_SIZE = 100;
+// Fraction of free memory a CachedDataIO may use by default.
+const double CACHE_MEMORY_FRACTION = 0.5;
+// Fraction of free memory a PrimaryBeamTable may use before it stores
+// only some of the channels.
+const double PBTABLE_MEMORY_FRACTION = 0.25;
+// Channels processed together in the cpu stacking kernel.
+const int CHANNEL_BLOCK = 256;
+// Positions or model components evaluated together in the cpu kernels,
+// must be a multiple of SIMD_WIDTH.
+const int POSITION_TILE = 1024;
+// Model components in gpu __constant__ memory at a time (64 kB).
+const size_t MOD_COMP_TILE = 3000;
+// Gridded model prediction and stacking, see ModsubGridChunkComputer
+// and StackNufftChunkComputer.
+// Kaiser-Bessel kernel width in cells, and image padding factor.
+const int GRID_KERNEL_WIDTH = 8;
+const int GRID_MAX_KERNEL_WIDTH = 16;
+const double GRID_PADDING = 2.;
+// Samples per cell in the tabulated kernel.
+const int GRID_KERNEL_SAMPLES = 1024;
+// Grid sizes are chosen between GRID_MIN_SIZE and GRID_MAX_SIZE from 
+// the uv coverage, GRID_DEFAULT_SIZE is used when it is not known.
+const int GRID_DEFAULT_SIZE = 1024;
+const int GRID_MIN_SIZE = 64;
+const int GRID_MAX_SIZE = 16384;
+const int GRID_MAX_W_PLANES = 32;
+// Largest relative error from interpolation between w planes and between
+// channels in ModsubGridChunkComputer.
+const double GRID_TOLERANCE = 1e-4;
+// Most grids in frequency per spectral window, one more than a power of 
+// two.
+const int GRID_MAX_FREQ_GRIDS = 9;
+// Fields with fewer point components than this use the direct sum.
+const int GRID_MIN_COMPONENTS = 256;
+// Fraction of free memory the grids may use.
+const double GRID_MEMORY_FRACTION = 0.25;
+// Default relative error of stacking with StackNufftChunkComputer.
+const double NUFFT_DEFAULT_TOLERANCE = 1e-4;
 const int THREADS = 128;
 const int BLOCKS = 128;
 
@@ -37,6 +77,13 @@ const double c = 299792458;
 const int PB_CONST = 0;
 const int PB_MS = 1;
 const int PB_FITS = 2;
+const int PB_GAUSSIAN = 3;
+const int PB_AIRY = 4;
+
+// Interpolation of image primary beams, first element of pbpar.
+const int PB_INTERP_NEAREST = 0;
+const int PB_INTERP_LINEAR = 1;
+const int PB_INTERP_CUBIC = 2;
 
 const int FILE_TYPE_NONE = 0;
 const int FILE_TYPE_MS = 1;
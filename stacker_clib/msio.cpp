@@ -19,7 +19,10 @@
 #include "Chunk.h"
 #include "definitions.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <stdlib.h>
+#include <limits.h>
 
 #ifdef CASACORE_VERSION_2
 #include <casacore/tables/Tables/TableError.h>
@@ -47,12 +50,27 @@ using casa::MSSelection;
 using casa::TableExprNode;
 using casa::Table;
 
+// All casacore calls of msio objects go through one lock. The table cache
+// and table locking of the casacore that comes with casapy are process 
+// wide and not safe for concurrent use, not even on different tables. 
+// Held for the lifetime of a CasacoreLock, so that it is released also
+// when casacore throws.
+static pthread_mutex_t casacoreMutex = PTHREAD_MUTEX_INITIALIZER;
+
+class CasacoreLock
+{
+	public:
+		CasacoreLock() { pthread_mutex_lock(&casacoreMutex); };
+		~CasacoreLock() { pthread_mutex_unlock(&casacoreMutex); };
+};
+
 msio::msio(const char* msinfile,
            const char * msoutfile,
 		   int datacolumn,
 		   const bool select_field, const char* field,
 		   bool one_ptg_per_chunk) : DataIO()
 {
+	CasacoreLock lock;
 #ifdef DEBUG
 	cout << "Creating MeasurementSet object with msinfile = \"" << msinfile << "\"." << endl;
 #endif
@@ -75,6 +93,9 @@ msio::msio(const char* msinfile,
 #endif
 	msincols = new ROMSColumns(*msin);
 	one_ptg_per_chunk_ = one_ptg_per_chunk;
+	weight_spectrum_in_ = not msincols->weightSpectrum().isNull() and
+	                      msin->nrow() > 0 and
+	                      msincols->weightSpectrum().isDefined(0);
 	ptg_warning_done = false;
 
 	if(datacolumn == col_data)
@@ -154,7 +175,10 @@ msio::msio(const char* msinfile,
 		msout = NULL;
 		msoutcols = NULL;
 	}
+	weight_spectrum_out_ = msoutcols != NULL and 
+	                       not msoutcols->weightSpectrum().isNull();
 	currentVisibility = 0;
+	nvis_ = (size_t)msincols->data().nrow();
 
 #ifdef DEBUG
 	cout << "Find number of spectral windows and channels." << endl;
@@ -211,10 +235,27 @@ msio::msio(const char* msinfile,
 
 	}
 
+	// No row has |u| or |v| longer than the distance between its 
+	// antennas.
+	max_baseline = 0.;
+	Array<double> positions = msincols->antenna().position().getColumn();
+	const double* p_pos = positions.data();
+	size_t nant = positions.nelements()/3;
+	for(size_t i = 0; i < nant; i++)
+	{
+		for(size_t j = 0; j < i; j++)
+		{
+			double dx = p_pos[3*i]-p_pos[3*j];
+			double dy = p_pos[3*i+1]-p_pos[3*j+1];
+			double dz = p_pos[3*i+2]-p_pos[3*j+2];
+			max_baseline = std::max(max_baseline, sqrt(dx*dx+dy*dy+dz*dz));
+		}
+	}
 }
 
 msio::~msio()
 {
+	CasacoreLock lock;
 	msin->flush();
 	msin->closeSubTables();
 	delete msincols;
@@ -231,11 +272,12 @@ msio::~msio()
 
 size_t msio::nvis()
 {
-	return (size_t)msincols->data().nrow();
+	return nvis_;
 }
 
 size_t msio::readChunk(Chunk& chunk)
 {
+	CasacoreLock lock;
 // 	readChunkIteratorbased(chunk);
 	return readChunkSimple(chunk);
 }
@@ -323,8 +365,6 @@ size_t msio::readChunkIteratorbased(Chunk& chunk)
 //
 size_t msio::readChunkSimple(Chunk& chunk)
 {
-	Vector<double> uvw;
-
 	chunk.resetSize();
 	chunk.set_dataset_id(dataset_id);
 
@@ -337,11 +377,16 @@ size_t msio::readChunkSimple(Chunk& chunk)
 	}
 
 
+	Vector<casa::Int> fieldIds, ddIds;
+	casa::Slicer rows(IPosition(1, currentVisibility), IPosition(1, chunk.size()),
+	                  casa::Slicer::endIsLength);
+	msincols->fieldId().getColumnRange(rows, fieldIds, true);
+
 	if(one_ptg_per_chunk_)
 	{
-		int fieldID = msincols->fieldId()(currentVisibility);
-		int inField = 0;
-		while(inField < chunk.size() and msincols->fieldId()(inField+currentVisibility) == fieldID)
+		int fieldID = fieldIds(0);
+		size_t inField = 0;
+		while(inField < chunk.size() and fieldIds(inField) == fieldID)
 		{
 			inField += 1;
 		}
@@ -368,66 +413,151 @@ size_t msio::readChunkSimple(Chunk& chunk)
 
 	chunk.reshape_data(this->nchan, this->nstokes);
 
-	int uvrow = 0, nchan, nstokes;
-	for(size_t i = 0; i < chunk.size(); i++)
+	// Rows with the same data description have the same shape and
+	// can be read in a single call.
+	rows = casa::Slicer(IPosition(1, currentVisibility), IPosition(1, chunk.size()),
+	                    casa::Slicer::endIsLength);
+	msincols->dataDescId().getColumnRange(rows, ddIds, true);
+
+	size_t runStart = 0;
+	for(size_t i = 1; i <= chunk.size(); i++)
 	{
-		Matrix<Complex> data;
-		Matrix<bool> flag;
-		Vector<float> weight;
+		if(i == chunk.size() or ddIds(i) != ddIds(runStart))
+		{
+			readRowRange(chunk, runStart, currentVisibility+runStart, 
+			             i-runStart, fieldIds, ddIds);
+			runStart = i;
+		}
+	}
+	return chunk.size();
+}
 
-		uvrow = i+currentVisibility;
-		if(datacolumn_ == col_data)
+void msio::readRowRange(Chunk& chunk, size_t first, size_t startrow, size_t n,
+                        const Vector<casa::Int>& fieldIds,
+                        const Vector<casa::Int>& ddIds)
+{
+	const casa::ROArrayColumn<Complex>* datacol = &msincols->correctedData();
+	if(datacolumn_ == col_data)
+		datacol = &msincols->data();
+	else if(datacolumn_ == col_model_data)
+		datacol = &msincols->modelData();
+
+	// Arrays are (stokes, chan, row) in column-major order.
+	IPosition shape = datacol->shape(startrow);
+	int nstokes = shape(0);
+	int nchan = shape(1);
+
+	casa::Slicer rows(IPosition(1, startrow), IPosition(1, n),
+	                  casa::Slicer::endIsLength);
+
+	// If the rows fill the chunk exactly the data can be read
+	// straight into the chunk, otherwise it is copied below.
+	bool in_place = chunk.get_layout() == Chunk::layout_interleaved and
+	                size_t(nchan*nstokes) == chunk.nChan()*chunk.nStokes();
+
+	Array<Complex> data;
+	if(in_place)
+	{
+		Array<Complex> chunkdata(IPosition(3, nstokes, nchan, n), 
+		                         chunk.inVis[first].data, casa::SHARE);
+		datacol->getColumnRange(rows, chunkdata);
+	}
+	else
+	{
+		datacol->getColumnRange(rows, data, true);
+	}
+
+	Array<bool> flag;
+	Array<Float> weight;
+	Array<double> uvw;
+	Vector<casa::Int> antenna1, antenna2;
+	msincols->antenna1().getColumnRange(rows, antenna1, true);
+	msincols->antenna2().getColumnRange(rows, antenna2, true);
+	msincols->flag().getColumnRange(rows, flag, true);
+	if(weight_spectrum_in_)
+		msincols->weightSpectrum().getColumnRange(rows, weight, true);
+	else
+		msincols->weight().getColumnRange(rows, weight, true);
+	msincols->uvw().getColumnRange(rows, uvw, true);
+
+	// Freshly resized arrays are contiguous.
+	const Complex* p_data = data.data();
+	const bool* p_flag = flag.data();
+	const Float* p_weight = weight.data();
+	const double* p_uvw = uvw.data();
+
+	for(size_t row = 0; row < n; row++)
+	{
+		size_t i = first+row;
+		Visibility& inVis = chunk.inVis[i];
+		Visibility& outVis = chunk.outVis[i];
+
+		inVis.index = startrow+row;
+		outVis.index = startrow+row;
+
+		inVis.nchan = nchan;
+		inVis.nstokes = nstokes;
+		outVis.nchan = nchan;
+		outVis.nstokes = nstokes;
+
+		// Weights are per channel, laid out as the flags.
+		const bool* rowflag = &p_flag[row*nstokes*nchan];
+		for(int stokes = 0; stokes < nstokes; stokes++)
 		{
-			msincols->data().get(uvrow, data);
+			for(int chan = 0; chan < nchan; chan++)
+				inVis.data_flag[nchan*stokes+chan] = int(rowflag[chan*nstokes+stokes]);
+
+			if(weight_spectrum_in_)
+			{
+				const Float* rowweight = &p_weight[row*nstokes*nchan];
+				for(int chan = 0; chan < nchan; chan++)
+					inVis.weight[nchan*stokes+chan] = float(rowweight[chan*nstokes+stokes]);
+			}
+			else
+			{
+				std::fill(&inVis.weight[nchan*stokes], 
+				          &inVis.weight[nchan*(stokes+1)],
+				          float(p_weight[row*nstokes+stokes]));
+			}
 		}
-		else if(datacolumn_ == col_model_data)
+		if(chunk.has_output())
 		{
-			msincols->modelData().get(uvrow, data);
+			std::copy(inVis.weight, &inVis.weight[nstokes*nchan], outVis.weight);
+			std::copy(inVis.data_flag, &inVis.data_flag[nstokes*nchan], 
+			          outVis.data_flag);
+		}
+
+		if(chunk.get_layout() == Chunk::layout_split)
+		{
+			const Complex* rowdata = &p_data[row*nstokes*nchan];
+			for(int stokes = 0; stokes < nstokes; stokes++)
+			{
+				for(int chan = 0; chan < nchan; chan++)
+				{
+					inVis.data_real[nchan*stokes+chan] = float(std::real(rowdata[chan*nstokes+stokes]));
+					inVis.data_imag[nchan*stokes+chan] = float(std::imag(rowdata[chan*nstokes+stokes]));
+				}
+			}
 		}
-		else if(datacolumn_ == col_corrected_data)
+		else if(not in_place)
 		{
-			msincols->correctedData().get(uvrow, data);
+			std::copy(&p_data[row*nstokes*nchan], &p_data[(row+1)*nstokes*nchan],
+			          inVis.data);
 		}
-		msincols->flag().get(uvrow, flag);
-		msincols->weight().get(uvrow, weight);
-		msincols->uvw().get(uvrow, uvw);
 
-		chunk.inVis[i].index = uvrow;
-		chunk.outVis[i].index = uvrow;
-
-        nchan = data.ncolumn();
-        nstokes = data.nrow();
-
-		chunk.inVis[i].nchan = nchan;
-		chunk.inVis[i].nstokes = nstokes;
-		chunk.outVis[i].nchan = nchan;
-		chunk.outVis[i].nstokes = nstokes;
-
-        for(int stokes = 0; stokes < nstokes; stokes++)
-        {
-            chunk.inVis[i].weight[stokes] = float(weight(stokes));
-            chunk.outVis[i].weight[stokes] = float(weight(stokes));
-            for(int chan = 0; chan < nchan; chan++)
-            {
-                chunk.inVis[i].data_real[nchan*stokes+chan] = float(std::real(data(stokes,chan)));
-                chunk.inVis[i].data_imag[nchan*stokes+chan] = float(std::imag(data(stokes,chan)));
-                chunk.inVis[i].data_flag[nchan*stokes+chan] = int(flag(stokes,chan));
-                chunk.outVis[i].data_flag[nchan*stokes+chan] = int(flag(stokes,chan));
-            }
-        }
-
-		chunk.inVis[i].u = float(uvw[0]);
-		chunk.inVis[i].v = float(uvw[1]);
-		chunk.inVis[i].w = float(uvw[2]);
-		chunk.inVis[i].fieldID = msincols->fieldId()(uvrow);
-		chunk.outVis[i].fieldID = msincols->fieldId()(uvrow);
-
-		chunk.inVis[i].spw  = msincols->dataDescId()(chunk.inVis[i].index);
-		chunk.inVis[i].freq = &freq[nchan*chunk.inVis[i].spw];
-		chunk.outVis[i].spw  = chunk.inVis[i].spw;
-		chunk.outVis[i].freq  = chunk.inVis[i].freq;
+		inVis.u = float(p_uvw[3*row]);
+		inVis.v = float(p_uvw[3*row+1]);
+		inVis.w = float(p_uvw[3*row+2]);
+		inVis.fieldID = fieldIds(i);
+		outVis.fieldID = fieldIds(i);
+		inVis.antenna1 = antenna1(row);
+		inVis.antenna2 = antenna2(row);
+
+		inVis.spw  = ddIds(i);
+		inVis.freq = &freq[this->nchan*inVis.spw];
+		outVis.spw  = inVis.spw;
+		outVis.freq  = inVis.freq;
 	}
-	return chunk.size();
 }
 
 void msio::writeChunk(Chunk& chunk)
@@ -435,51 +565,115 @@ void msio::writeChunk(Chunk& chunk)
 	if(msout == NULL)
 		return;
 
-	Vector<double> uvw;
-	for(size_t i = 0; i < chunk.size(); i++)
+	CasacoreLock lock;
+
+	// Consecutive rows with the same shape are written in a single call.
+	size_t runStart = 0;
+	for(size_t i = 1; i <= chunk.size(); i++)
 	{
-		int nchan = chunk.outVis[i].nchan, 
-			nstokes = chunk.outVis[i].nstokes;
-		Matrix<Complex> data(nstokes, nchan);
-		Matrix<bool> flag(nstokes, nchan);
-		for(int chan = 0; chan < nchan; chan++)
+		if(i == chunk.size() or 
+		   chunk.outVis[i].index != chunk.outVis[i-1].index+1 or
+		   chunk.outVis[i].nchan != chunk.outVis[runStart].nchan or
+		   chunk.outVis[i].nstokes != chunk.outVis[runStart].nstokes)
 		{
-			for(int stokes = 0; stokes < nstokes; stokes++)
-			{
-				Complex vis = Complex(chunk.outVis[i].data_real[stokes*nchan+chan],
-						              chunk.outVis[i].data_imag[stokes*nchan+chan]);
-				data(stokes, chan) = vis;
-				flag(stokes, chan) = chunk.outVis[i].data_flag[stokes*nchan+chan];
-			}
+			writeRowRange(chunk, runStart, i-runStart);
+			runStart = i;
 		}
-// 		msoutcols->data().put(chunk.outVis[i].index, data);
-		if(datacolumn_ == col_data)
+	}
+}
+
+void msio::writeRowRange(Chunk& chunk, size_t first, size_t n)
+{
+	int nchan = chunk.outVis[first].nchan, 
+	    nstokes = chunk.outVis[first].nstokes;
+
+	casa::ArrayColumn<Complex>* datacol = &msoutcols->correctedData();
+	if(datacolumn_ == col_data)
+		datacol = &msoutcols->data();
+	else if(datacolumn_ == col_model_data)
+		datacol = &msoutcols->modelData();
+
+	casa::Slicer rows(IPosition(1, chunk.outVis[first].index), IPosition(1, n),
+	                  casa::Slicer::endIsLength);
+
+	// Interleaved data that fills the chunk exactly is written directly
+	// from the chunk.
+	if(chunk.get_layout() == Chunk::layout_interleaved and
+	   size_t(nchan*nstokes) == chunk.nChan()*chunk.nStokes())
+	{
+		Array<Complex> data(IPosition(3, nstokes, nchan, n), 
+		                    chunk.outVis[first].data, casa::SHARE);
+		datacol->putColumnRange(rows, data);
+	}
+	else
+	{
+		Array<Complex> data(IPosition(3, nstokes, nchan, n));
+		Complex* p_data = data.data();
+		for(size_t row = 0; row < n; row++)
 		{
-			msoutcols->data().put(chunk.outVis[i].index, data);
+			Visibility& outVis = chunk.outVis[first+row];
+			Complex* rowdata = &p_data[row*nstokes*nchan];
+			if(chunk.get_layout() == Chunk::layout_interleaved)
+			{
+				std::copy(outVis.data, &outVis.data[nstokes*nchan], rowdata);
+				continue;
+			}
+			for(int chan = 0; chan < nchan; chan++)
+			{
+				for(int stokes = 0; stokes < nstokes; stokes++)
+				{
+					rowdata[chan*nstokes+stokes] = Complex(outVis.data_real[stokes*nchan+chan],
+					                                       outVis.data_imag[stokes*nchan+chan]);
+				}
+			}
 		}
-		else if(datacolumn_ == col_model_data)
+		datacol->putColumnRange(rows, data);
+	}
+
+	Array<bool> flag(IPosition(3, nstokes, nchan, n));
+	Array<Float> weight(IPosition(2, nstokes, n));
+	Array<Float> weightSpectrum;
+	if(weight_spectrum_out_)
+		weightSpectrum.resize(IPosition(3, nstokes, nchan, n));
+	Vector<casa::Int> fieldIds(n);
+	bool* p_flag = flag.data();
+	Float* p_weight = weight.data();
+	Float* p_spectrum = weightSpectrum.data();
+
+	for(size_t row = 0; row < n; row++)
+	{
+		Visibility& outVis = chunk.outVis[first+row];
+		bool* rowflag = &p_flag[row*nstokes*nchan];
+		for(int chan = 0; chan < nchan; chan++)
 		{
-			msoutcols->modelData().put(chunk.outVis[i].index, data);
+			for(int stokes = 0; stokes < nstokes; stokes++)
+			{
+				rowflag[chan*nstokes+stokes] = outVis.data_flag[stokes*nchan+chan];
+			}
 		}
-		else if(datacolumn_ == col_corrected_data)
+		// WEIGHT is the mean of the channel weights.
+		for(int stokes = 0; stokes < nstokes; stokes++)
 		{
-			msoutcols->correctedData().put(chunk.outVis[i].index, data);
+			double sum = 0.;
+			for(int chan = 0; chan < nchan; chan++)
+				sum += outVis.weight[stokes*nchan+chan];
+			p_weight[row*nstokes+stokes] = Float(sum/nchan);
+
+			if(weight_spectrum_out_)
+			{
+				Float* rowweight = &p_spectrum[row*nstokes*nchan];
+				for(int chan = 0; chan < nchan; chan++)
+					rowweight[chan*nstokes+stokes] = outVis.weight[stokes*nchan+chan];
+			}
 		}
-		msoutcols->flag().put(chunk.outVis[i].index, flag);
+		fieldIds(row) = outVis.fieldID;
 	}
-	for(size_t i = 0; i < chunk.size(); i++)
-	{
-		size_t nstokes = chunk.outVis[i].nstokes;
-		Vector<Float> weight(nstokes);
-		for(size_t stokes = 0; stokes<nstokes; stokes++)
-			weight(stokes) = chunk.outVis[i].weight[stokes];
 
-		msoutcols->weight().put(chunk.outVis[i].index, weight);
-	}
-	for(size_t i = 0; i < chunk.size(); i++)
-	{
-		msoutcols->fieldId().put(chunk.outVis[i].index, chunk.outVis[i].fieldID);
-	}
+	msoutcols->flag().putColumnRange(rows, flag);
+	msoutcols->weight().putColumnRange(rows, weight);
+	if(weight_spectrum_out_)
+		msoutcols->weightSpectrum().putColumnRange(rows, weightSpectrum);
+	msoutcols->fieldId().putColumnRange(rows, fieldIds);
 }
 
 int msio::nPointings()
@@ -504,6 +698,7 @@ void msio::setPhaseCentre(int fieldID, double x, double y)
 	if(!msout)
 		return;
 
+	CasacoreLock lock;
 	newPhaseCentre(IPosition(2,0,0)) = x;
 	newPhaseCentre(IPosition(2,1,0)) = y;
 
@@ -531,3 +726,8 @@ float* msio::getFreq(int spw)
 {
 	return &freq[spw*nchan];
 }
+
+double msio::maxBaseline()
+{
+	return max_baseline;
+}
@@ -26,6 +26,7 @@
 #include <casacore/casa/Arrays/Vector.h>
 #include <casacore/casa/Arrays/VectorIter.h>
 #include <casacore/casa/Arrays/MatrixIter.h>
+#include <casacore/casa/Arrays/Slicer.h>
 #include <casacore/ms/MeasurementSets/MSTable.h>
 #include <casacore/ms/MeasurementSets/MSColumns.h>
 #include <casacore/ms/MeasurementSets/MeasurementSet.h>
@@ -36,6 +37,7 @@
 #include <casa/Arrays/Vector.h>
 #include <casa/Arrays/VectorIter.h>
 #include <casa/Arrays/MatrixIter.h>
+#include <casa/Arrays/Slicer.h>
 #include <ms/MeasurementSets/MSTable.h>
 #include <ms/MeasurementSets/MSColumns.h>
 #include <ms/MeasurementSets/MeasurementSet.h>
@@ -78,15 +80,26 @@ class msio : public DataIO
 		MeasurementSet* msout_nonsorted;
 		MSColumns* msoutcols;
 		size_t currentVisibility;
+		size_t nvis_;
+		double max_baseline;
 		size_t readChunkDummy(Chunk& chunk);
 		size_t readChunkSimple(Chunk& chunk);
 		size_t readChunkIteratorbased(Chunk& chunk);
+		void readRowRange(Chunk& chunk, size_t first, size_t startrow, size_t n,
+		                  const Vector<casa::Int>& fieldIds,
+		                  const Vector<casa::Int>& ddIds);
+		void writeRowRange(Chunk& chunk, size_t first, size_t n);
 
 		int nfields;
 		float* x_phase_centre;
 		float* y_phase_centre;
 		int datacolumn_;
 		bool one_ptg_per_chunk_;
+		// Per channel weights are read from and written to WEIGHT_SPECTRUM
+		// if it has data, otherwise WEIGHT is used for all channels.
+		bool weight_spectrum_in_;
+		bool weight_spectrum_out_;
+
 		int ptg_breaks_in_a_row;
 		bool ptg_warning_done;
 
@@ -115,6 +128,7 @@ class msio : public DataIO
 		size_t nChan();
 		size_t nSpw();
 		float* getFreq(int spw);
+		double maxBaseline();
 };
 
 #endif //inclusion guard
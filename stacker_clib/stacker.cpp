@@ -18,6 +18,10 @@
 // Library to stack and modsub ms data.
 
 // includes/*{{{*/
+#include <string>
+#include <limits.h>
+#include <stdlib.h>
+
 #include "MSComputer.h"
 #include "DataIO.h"
 #include "PrimaryBeam.h"
@@ -25,7 +29,14 @@
 #include "Model.h"
 #include "Coords.h"
 #include "ModsubChunkComputer.h"
+#include "ModsubGridChunkComputer.h"
 #include "StackChunkComputer.h"
+#include "StackNufftChunkComputer.h"
+#include "StackMCChunkComputer.h"
+#include "StackMultiChunkComputer.h"
+#include "msio.h"
+#include "AveragingDataIO.h"
+#include "CachedDataIO.h"
 #include "definitions.h"
 #include "config.h"
 #ifdef USE_CUDA
@@ -45,18 +56,54 @@ void cpp_stack_mc(int infiletype, const char* infile, int infileoptions,
                   double* x, double* y, double* weight, int nstack, int nmc,
                   char** modelfiles, 
                   double* res_flux, double* res_weight, double* limits, int nbin,
-                  bool use_cuda = true);
+                  bool use_cuda = true,
+                  int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
 double cpp_stack(int infiletype, const char* infile, int infileoptions, 
                  int outfiletype, const char* outfile, int outfileoptions, 
                  int pbtype, char* pbfile, double* pbpar, int npbpar,
                  double* x, double* y, double* weight, int nstack,
-                 bool use_cuda = false);
+                 bool use_cuda = false,
+                 bool use_nufft = false, double nufft_tolerance = 0.,
+                 int nufft_size = 0,
+                 int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
+double cpp_stack_profile(int infiletype, const char* infile, int infileoptions, 
+                         int pbtype, char* pbfile, double* pbpar, int npbpar,
+                         double* x, double* y, double* weight, int nstack,
+                         double* bins, int nbin, 
+                         double* res_flux, double* res_weight,
+                         float bda_tolerance = 0.,
+                         int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
+void cpp_stack_multi(int infiletype, const char* infile, int infileoptions, 
+                     char** outfiles,
+                     int pbtype, char* pbfile, double* pbpar, int npbpar,
+                     double* x, double* y, double* weight, int* nstack,
+                     int ntarget, double* res_flux,
+                     int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
 void cpp_modsub(int infiletype, const char* infile, int infileoptions, 
                 int outfiletype, const char* outfile, int outfileoptions, 
                 const char* modelfile,
                 int pbtype, const char* pbfile, double* pbpar, int npbpar,
 				bool subtract = true, bool use_cuda = false,
-				const bool selectField=false, const char* field="");
+				const bool selectField=false, const char* field="",
+				bool use_grid = false, double grid_cell = 0., int grid_size = 0,
+				bool skip_flagged = false,
+				int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
+CachedDataIO* cpp_open_cache(int infiletype, const char* infile, 
+                             int infileoptions, double max_bytes = 0.);
+double cpp_stack_cache(CachedDataIO* cache,
+                       int pbtype, char* pbfile, double* pbpar, int npbpar,
+                       double* x, double* y, double* weight, int nstack,
+                       int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
+double cpp_stack_vislist(int nvis, int* infiletypes, char** infiles, 
+                         int* infileoptions,
+                         int pbtype, char* pbfile, double* pbpar, int npbpar,
+                         double* x, double* y, double* weight, int nstack,
+                         double* res_flux, double* res_weight,
+                         int n_thread = 0, int n_chunk = 0, int chunk_size = 0);
+PrimaryBeam* createPrimaryBeam(int pbtype, const char* pbfile, 
+                               double* pbpar, int npbpar);
+int msColumn(int infileoptions);
+std::string canonicalPath(const char* file);
 
 // Functions to interface with python module.
 extern "C"{/*{{{*/
@@ -64,24 +111,38 @@ extern "C"{/*{{{*/
 	// Input arguments:
 	// - infile: The input ms file.
 	// - outfile: The output ms file, can be the same as input ms file.
+	// - pbtype: Type of primary beam, one of PB_CONST, PB_MS, PB_GAUSSIAN
+	//   or PB_AIRY.
 	// - pbfile: A casa image of the primary beam, used to calculate primary beam correction.
+	// - pbpar: Primary beam parameters, see createPrimaryBeam.
 	// - x: x coordinate of each stacking position (in radian).
 	// - y: y coordinate of each stacking position (in radian).
 	// - weight: weight of each stacking position.
 	// - nstack: length of x, y and weight lists.
+	// - use_nufft: Interpolate the phase factors from a grid of the
+	//   positions, for large numbers of positions. nufft_tolerance is the 
+	//   largest relative error and nufft_size the number of pixels of the 
+	//   grid along each axis, 0 to choose automatically.
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
 	// Returns average of all visibilities. Estimate of flux for point sources.
 	//
 	double stack(int infiletype, const char* infile, int infileoptions, 
 	             int outfiletype, const char* outfile, int outfileoptions, 
 	             int pbtype, char* pbfile, double* pbpar, int npbpar,
 	             double* x, double* y, double* weight, int nstack,
-	             bool use_cuda = false)
+	             bool use_cuda = false,
+	             bool use_nufft = false, double nufft_tolerance = 0.,
+	             int nufft_size = 0,
+	             int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
 	{
 		double flux;
 		flux = cpp_stack(infiletype, infile, infileoptions, 
 		                 outfiletype, outfile, outfileoptions,
 		                 pbtype, pbfile, pbpar, npbpar, 
-		                 x, y, weight, nstack, use_cuda);
+		                 x, y, weight, nstack, use_cuda,
+		                 use_nufft, nufft_tolerance, nufft_size,
+		                 n_thread, n_chunk, chunk_size);
 		return flux;
 	};/*}}}*/
 
@@ -98,7 +159,9 @@ extern "C"{/*{{{*/
 	// - res_flux: Array to write result to (must be nbin*nmc long).
 	// - res_weight: Array to write result to (must be nbin*nmc long).
 	// - nbin: Number of bins to calculate flux in.
-	// - use_cuda: Switch to 
+	// - use_cuda: Switch to use gpu, otherwise all cpu cores are used.
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
 	// Returns average of all visibilities. Estimate of flux for point sources.
 	//
 	void stack_mc(int infiletype, const char* infile, int infileoptions, 
@@ -106,37 +169,180 @@ extern "C"{/*{{{*/
 	              double* x, double* y, double* weight, int nstack, int nmc,
 	              char** modelfiles, 
 	              double* res_flux, double* res_weight, double* bins, int nbin,
-	              bool use_cuda = true)
+	              bool use_cuda = true,
+	              int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
 	{
 		cpp_stack_mc(infiletype, infile, infileoptions,
 		             pbtype, pbfile, pbpar, npbpar,
 		             x, y, weight, nstack, nmc,
 		             modelfiles,
 		             res_flux, res_weight, bins, nbin,
-		             use_cuda);
+		             use_cuda, n_thread, n_chunk, chunk_size);
 // 		int i;
 // 		for(i = 0; i < nmc; i++)
 // 			cout << modelfiles[i] << endl;
 	};/*}}}*/
 
+	// Stacking without output/*{{{*/
+	// Only accumulates the flux and its profile in uv distance, 
+	// no stacked visibilities are stored or written.
+	// Input arguments:
+	// - infile: The input ms file.
+	// - pbtype, pbfile, pbpar, npbpar: As for stack.
+	// - x, y, weight, nstack: As for stack.
+	// - bins: Edges of uv-distance bins in metres (nbin+1 values).
+	// - res_flux: Array to write weighted mean flux in each bin to 
+	//   (nbin long).
+	// - res_weight: Array to write sum of weights in each bin to 
+	//   (nbin long).
+	// - bda_tolerance: Largest fractional amplitude loss accepted when
+	//   averaging rows of each baseline in time before stacking, 0 to
+	//   stack all rows as they are.
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
+	// Returns average of all visibilities. Estimate of flux for point sources.
+	//
+	double stack_profile(int infiletype, const char* infile, int infileoptions, 
+	                     int pbtype, char* pbfile, double* pbpar, int npbpar,
+	                     double* x, double* y, double* weight, int nstack,
+	                     double* bins, int nbin, 
+	                     double* res_flux, double* res_weight,
+	                     float bda_tolerance = 0.,
+	                     int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
+	{
+		return cpp_stack_profile(infiletype, infile, infileoptions,
+		                         pbtype, pbfile, pbpar, npbpar,
+		                         x, y, weight, nstack, bins, nbin,
+		                         res_flux, res_weight, bda_tolerance,
+		                         n_thread, n_chunk, chunk_size);
+	};/*}}}*/
+
+	// Stacking of several independent coordinate lists/*{{{*/
+	// All lists are stacked in a single pass over the data.
+	// Input arguments:
+	// - infile: The input ms file.
+	// - outfiles: One output ms file for each list, "" to not write the
+	//   stacked visibilities of that list. Can be NULL for no output at all.
+	//   Must differ from infile and from each other.
+	// - pbtype, pbfile, pbpar, npbpar: As for stack.
+	// - x, y, weight: Positions and weights of all lists after each other.
+	// - nstack: Number of positions in each list (ntarget long).
+	// - ntarget: Number of coordinate lists.
+	// - res_flux: Array to write the flux of each list to (ntarget long).
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
+	//
+	void stack_multi(int infiletype, const char* infile, int infileoptions, 
+	                 char** outfiles,
+	                 int pbtype, char* pbfile, double* pbpar, int npbpar,
+	                 double* x, double* y, double* weight, int* nstack,
+	                 int ntarget, double* res_flux,
+	                 int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
+	{
+		cpp_stack_multi(infiletype, infile, infileoptions, outfiles,
+		                pbtype, pbfile, pbpar, npbpar,
+		                x, y, weight, nstack, ntarget, res_flux,
+		                n_thread, n_chunk, chunk_size);
+	};/*}}}*/
+
+	// Reads a data set into memory to be stacked many times/*{{{*/
+	// Input arguments:
+	// - infile: The input ms file.
+	// - max_bytes: Memory the cache may use, 0 for half the free memory.
+	// Returns a handle to pass to stack_cache and close_cache, or NULL if
+	// the data could not be read or does not fit in memory.
+	//
+	void* open_cache(int infiletype, const char* infile, int infileoptions,
+	                 double max_bytes)
+	{
+		return (void*)cpp_open_cache(infiletype, infile, infileoptions, 
+		                             max_bytes);
+	};/*}}}*/
+
+	// Frees a cache from open_cache/*{{{*/
+	void close_cache(void* cache)
+	{
+		delete (CachedDataIO*)cache;
+	};/*}}}*/
+
+	// Stacking of cached data/*{{{*/
+	// As stack without output, but reads the data from a cache 
+	// created by open_cache. 
+	// Input arguments:
+	// - cache: Handle from open_cache.
+	// - pbtype, pbfile, pbpar, npbpar: As for stack.
+	// - x, y, weight, nstack: As for stack.
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
+	// Returns average of all visibilities. Estimate of flux for point sources.
+	//
+	double stack_cache(void* cache,
+	                   int pbtype, char* pbfile, double* pbpar, int npbpar,
+	                   double* x, double* y, double* weight, int nstack,
+	                   int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
+	{
+		return cpp_stack_cache((CachedDataIO*)cache,
+		                       pbtype, pbfile, pbpar, npbpar,
+		                       x, y, weight, nstack,
+		                       n_thread, n_chunk, chunk_size);
+	};/*}}}*/
+
+	// Stacking of several data sets at once/*{{{*/
+	// As stack without output, for nvis input files that are read 
+	// concurrently and computed by the same threads.
+	// Input arguments:
+	// - infiletypes, infiles, infileoptions: As for stack, one per input.
+	// - pbtype, pbfile, pbpar, npbpar: As for stack, used for all inputs.
+	// - x, y, weight, nstack: As for stack.
+	// - res_flux, res_weight: Arrays of length nvis, set to the flux and 
+	//   sum of weights of each input.
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
+	// Returns weighted average of all visibilities of all inputs.
+	//
+	double stack_vislist(int nvis, int* infiletypes, char** infiles, 
+	                     int* infileoptions,
+	                     int pbtype, char* pbfile, double* pbpar, int npbpar,
+	                     double* x, double* y, double* weight, int nstack,
+	                     double* res_flux, double* res_weight,
+	                     int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
+	{
+		return cpp_stack_vislist(nvis, infiletypes, infiles, infileoptions,
+		                         pbtype, pbfile, pbpar, npbpar,
+		                         x, y, weight, nstack, res_flux, res_weight,
+		                         n_thread, n_chunk, chunk_size);
+	};/*}}}*/
+
 	// Function to subtract model from uvdata/*{{{*/
 	// Input arguments:
 	// - infile: The input ms file.
 	// - outfile: The output ms file, can be the same as input ms file.
 	// - infile: cl file with the model to be subtracted
 	// - pbfile: A casa image of the primary beam, used to calculate primary beam correction.
+	// - use_grid: Predict point components from an FFT of the model 
+	//   image, grid_cell (radians) and grid_size (pixels) set the image,
+	//   0 to choose automatically.
+	// - skip_flagged: Leave blocks of channels that are completely flagged
+	//   unchanged instead of subtracting the model from them.
+	// - n_thread, n_chunk, chunk_size: Number of threads, number of chunks
+	//   and visibilities per chunk, 0 to choose automatically.
 	void modsub(int infiletype, char* infile, int infileoptions, 
 	            int outfiletype, char* outfile, int outfileoptions,
 	            char* modelfile, 
 	            int pbtype, const char* pbfile, double* pbpar, int npbpar,
 	            bool subtract = true, bool use_cuda = false,
-				const bool selectField = false, const char* field = "")
+				const bool selectField = false, const char* field = "",
+				bool use_grid = false, double grid_cell = 0., int grid_size = 0,
+				bool skip_flagged = false,
+				int n_thread = 0, int n_chunk = 0, int chunk_size = 0)
 	{
 		cpp_modsub(infiletype, infile, infileoptions, 
 		           outfiletype, outfile, outfileoptions,
 		           modelfile, 
 		           pbtype, pbfile, pbpar, npbpar,
-		           subtract, use_cuda, selectField, field);
+		           subtract, use_cuda, selectField, field,
+		           use_grid, grid_cell, grid_size, skip_flagged,
+		           n_thread, n_chunk, chunk_size);
 	};/*}}}*/
 };/*}}}*/
 
@@ -145,18 +351,16 @@ void cpp_stack_mc(int infiletype, const char* infile, int infileoptions, /*{{{*/
                   double* x, double* y, double* weight, int nstack, int nmc,
                   char** modelfiles, 
                   double* res_flux, double* res_weight, double* bins, int nbin,
-                  bool use_cuda)
+                  bool use_cuda, int n_thread, int n_chunk, int chunk_size)
 {
-#ifdef USE_CUDA
-	PrimaryBeam* pb;
-	if(pbtype == PB_CONST)
-		pb = (PrimaryBeam*)new ConstantPrimaryBeam;
-	else if(pbtype == PB_MS)
+#ifndef USE_CUDA
+	if(use_cuda)
 	{
-		pb = (PrimaryBeam*)new MSPrimaryBeam(pbfile);
+		cout << "CUDA support is not compiled. Recompile to enable." << endl;
+		return;
 	}
-	else
-		pb = (PrimaryBeam*)new ConstantPrimaryBeam;
+#endif
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
 
 	Coords** coordlists = new Coords*[nmc];
 	Model** models = new Model*[nmc];
@@ -178,30 +382,29 @@ void cpp_stack_mc(int infiletype, const char* infile, int infileoptions, /*{{{*/
 			models[i] = NULL;
 	}
 
-	StackMCCCGpu* cc;
-	int n_thread = N_THREAD;
+	ChunkComputer* cc;
 	if(use_cuda)
 	{
+#ifdef USE_CUDA
 		cout << "Creating cc." << endl;
-		cc = new StackMCCCGpu(coordlists, models, pb, nmc, bins, nbin);
+		cc = (ChunkComputer*) new StackMCCCGpu(coordlists, models, pb, nmc, bins, nbin);
 		n_thread = 1;
+#endif
 	}
 	else
 	{
-		cout << "Non CUDA support is not compiled. Recompile to enable." 
-		     << endl;
-		return;
+		cc = (ChunkComputer*) new StackMCChunkComputer(coordlists, models, pb, nmc, bins, nbin);
 	}
 
-	MSComputer* computer;
+	MSComputer* computer = NULL;
 	try
 	{
 		cout << "Creating computer." << endl;
 		cout << "infile: " << infile << " with type " << infiletype << endl;
-		computer = new MSComputer((ChunkComputer*)cc, 
+		computer = new MSComputer(cc, 
 								  infiletype, infile, infileoptions,
 								  FILE_TYPE_NONE, "", 0,
-								  n_thread);
+								  n_thread, n_chunk, chunk_size);
 		cout << "Computer created." << endl;
 		computer->run();
 	}
@@ -209,10 +412,21 @@ void cpp_stack_mc(int infiletype, const char* infile, int infileoptions, /*{{{*/
 	{
 		std::cerr << e.what() << std::endl;
 	}
-// 	double averageFlux =  (double)cc->flux();
 	cout << "Time to copy results." << endl;
-	double* bin_flux = cc->get_flux();
-	double* bin_weight = cc->get_weight();
+	double* bin_flux = NULL;
+	double* bin_weight = NULL;
+	if(use_cuda)
+	{
+#ifdef USE_CUDA
+		bin_flux = ((StackMCCCGpu*)cc)->get_flux();
+		bin_weight = ((StackMCCCGpu*)cc)->get_weight();
+#endif
+	}
+	else
+	{
+		bin_flux = ((StackMCChunkComputer*)cc)->get_flux();
+		bin_weight = ((StackMCChunkComputer*)cc)->get_weight();
+	}
 	for(int i = 0; i < nmc*nbin; i++)
 	{
 		res_flux[i] = bin_flux[i];
@@ -233,30 +447,19 @@ void cpp_stack_mc(int infiletype, const char* infile, int infileoptions, /*{{{*/
 	delete computer;
 	delete cc;
 	delete pb;
-#else
-	cout << "CUDA support is not compiled. Recompile to enable." << endl;
-	return;
-#endif
 }/*}}}*/
 double cpp_stack(int infiletype, const char* infile, int infileoptions, /*{{{*/
                  int outfiletype, const char* outfile, int outfileoptions, 
 			     int pbtype, char* pbfile, double* pbpar, int npbpar,
 				 double* x, double* y, double* weight, int nstack,
-				 bool use_cuda)
+				 bool use_cuda, 
+				 bool use_nufft, double nufft_tolerance, int nufft_size,
+				 int n_thread, int n_chunk, int chunk_size)
 {
-	PrimaryBeam* pb;
-	if(pbtype == PB_CONST)
-		pb = (PrimaryBeam*)new ConstantPrimaryBeam;
-	else if(pbtype == PB_MS)
-	{
-		pb = (PrimaryBeam*)new MSPrimaryBeam(pbfile);
-	}
-	else
-		pb = (PrimaryBeam*)new ConstantPrimaryBeam;
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
 
 	Coords coords(x, y, weight, nstack);
 	ChunkComputer* cc;
-	int n_thread = N_THREAD;
 	if(use_cuda)
 	{
 #ifdef USE_CUDA
@@ -269,16 +472,25 @@ double cpp_stack(int infiletype, const char* infile, int infileoptions, /*{{{*/
 	}
 	else
 	{
-		cc = (ChunkComputer*) new StackChunkComputer(&coords, pb);
+		StackChunkComputer* scc;
+		if(use_nufft)
+			scc = new StackNufftChunkComputer(&coords, pb, 
+			                                  nufft_tolerance, 0., nufft_size);
+		else
+			scc = new StackChunkComputer(&coords, pb);
+		// Without output only the flux is needed.
+		if(outfiletype == FILE_TYPE_NONE or strcmp(outfile, "") == 0)
+			scc->setAccumulateOnly(true);
+		cc = (ChunkComputer*) scc;
 	}
 
-	MSComputer* computer;
+	MSComputer* computer = NULL;
 	try
 	{
 		computer = new MSComputer(cc, 
 								  infiletype, infile, infileoptions,
 								  outfiletype, outfile, outfileoptions,
-								  n_thread);
+								  n_thread, n_chunk, chunk_size);
 		computer->run();
 	}
 	catch(fileException e)
@@ -300,28 +512,313 @@ double cpp_stack(int infiletype, const char* infile, int infileoptions, /*{{{*/
 // 	return 0.;
 }/*}}}*/
 
+double cpp_stack_profile(int infiletype, const char* infile, int infileoptions, /*{{{*/
+                         int pbtype, char* pbfile, double* pbpar, int npbpar,
+                         double* x, double* y, double* weight, int nstack,
+                         double* bins, int nbin, 
+                         double* res_flux, double* res_weight,
+                         float bda_tolerance,
+                         int n_thread, int n_chunk, int chunk_size)
+{
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
+
+	Coords coords(x, y, weight, nstack);
+	StackChunkComputer* cc = new StackChunkComputer(&coords, pb);
+	cc->setAccumulateOnly(true);
+	cc->setProfileBins(bins, nbin);
+
+	double averageFlux = 0.;
+	for(int i = 0; i < nbin; i++)
+	{
+		res_flux[i] = 0.;
+		res_weight[i] = 0.;
+	}
+
+	MSComputer* computer = NULL;
+	try
+	{
+		if(bda_tolerance > 0. and infiletype == FILE_TYPE_MS)
+		{
+			DataIO* data = (DataIO*)(new msio(infile, "", msColumn(infileoptions), 
+			                                  false, "", false));
+			data = (DataIO*)(new AveragingDataIO(data, x, y, nstack, 
+			                                     bda_tolerance, pb));
+			computer = new MSComputer((ChunkComputer*)cc, data,
+			                          n_thread, n_chunk, chunk_size);
+		}
+		else
+			computer = new MSComputer((ChunkComputer*)cc, 
+			                          infiletype, infile, infileoptions,
+			                          FILE_TYPE_NONE, "", 0,
+			                          n_thread, n_chunk, chunk_size);
+		computer->run();
+		averageFlux = cc->flux();
+		cc->profile(res_flux, res_weight);
+	}
+	catch(fileException e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	delete computer;
+	delete cc;
+	delete pb;
+
+	return averageFlux;
+}/*}}}*/
+
+void cpp_stack_multi(int infiletype, const char* infile, int infileoptions, /*{{{*/
+                     char** outfiles,
+                     int pbtype, char* pbfile, double* pbpar, int npbpar,
+                     double* x, double* y, double* weight, int* nstack,
+                     int ntarget, double* res_flux,
+                     int n_thread, int n_chunk, int chunk_size)
+{
+	for(int i = 0; i < ntarget; i++)
+		res_flux[i] = 0.;
+
+	if(infiletype != FILE_TYPE_MS)
+	{
+		cerr << "Multi-target stacking is only supported for ms files." << endl;
+		return;
+	}
+
+	// Outputs are written while the input is read, they can therefore 
+	// not share tables with the input or with each other. Paths are 
+	// compared after resolving links and relative parts.
+	for(int i = 0; outfiles != NULL && i < ntarget; i++)
+	{
+		if(strcmp(outfiles[i], "") == 0)
+			continue;
+		if(canonicalPath(outfiles[i]) == canonicalPath(infile))
+		{
+			cerr << "Output file " << outfiles[i] 
+			     << " can not be the same as the input file." << endl;
+			return;
+		}
+		for(int j = 0; j < i; j++)
+		{
+			if(strcmp(outfiles[j], "") != 0 and
+			   canonicalPath(outfiles[i]) == canonicalPath(outfiles[j]))
+			{
+				cerr << "Output file " << outfiles[i] 
+				     << " is used for more than one target." << endl;
+				return;
+			}
+		}
+	}
+
+	int column = msColumn(infileoptions);
+
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
+
+	Coords** coordlists = new Coords*[ntarget];
+	DataIO** outputs = new DataIO*[ntarget];
+	MSComputer* computer = NULL;
+	ChunkComputer* cc = NULL;
+	int offset = 0;
+	for(int i = 0; i < ntarget; i++)
+	{
+		coordlists[i] = new Coords(&x[offset], &y[offset], &weight[offset], 
+		                           nstack[i]);
+		offset += nstack[i];
+		outputs[i] = NULL;
+	}
+
+	try
+	{
+		for(int i = 0; outfiles != NULL && i < ntarget; i++)
+		{
+			if(strcmp(outfiles[i], "") != 0)
+				outputs[i] = (DataIO*)(new msio(infile, outfiles[i], column, 
+				                                false, "", false));
+		}
+
+		cc = (ChunkComputer*) new StackMultiChunkComputer(coordlists, pb, 
+		                                                  outputs, ntarget);
+		computer = new MSComputer(cc, 
+		                          infiletype, infile, infileoptions,
+		                          FILE_TYPE_NONE, "", 0,
+		                          n_thread, n_chunk, chunk_size);
+		computer->run();
+
+		for(int i = 0; i < ntarget; i++)
+			res_flux[i] = ((StackMultiChunkComputer*)cc)->flux(i);
+	}
+	catch(fileException e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	delete computer;
+	delete cc;
+	for(int i = 0; i < ntarget; i++)
+	{
+		delete coordlists[i];
+		if(outputs[i] != NULL)
+			delete outputs[i];
+	}
+	delete[] coordlists;
+	delete[] outputs;
+	delete pb;
+}/*}}}*/
+
+CachedDataIO* cpp_open_cache(int infiletype, const char* infile, /*{{{*/
+                             int infileoptions, double max_bytes)
+{
+	if(infiletype != FILE_TYPE_MS)
+	{
+		cerr << "Caching is only supported for ms files." << endl;
+		return NULL;
+	}
+
+	CachedDataIO* cache = NULL;
+	try
+	{
+		msio data(infile, "", msColumn(infileoptions), false, "", false);
+		cache = new CachedDataIO((DataIO*)&data, max_bytes);
+	}
+	catch(fileException e)
+	{
+		std::cerr << e.what() << std::endl;
+		return NULL;
+	}
+
+	if(not cache->complete())
+	{
+		delete cache;
+		return NULL;
+	}
+	return cache;
+}/*}}}*/
+
+double cpp_stack_cache(CachedDataIO* cache, /*{{{*/
+                       int pbtype, char* pbfile, double* pbpar, int npbpar,
+                       double* x, double* y, double* weight, int nstack,
+                       int n_thread, int n_chunk, int chunk_size)
+{
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
+
+	Coords coords(x, y, weight, nstack);
+	StackChunkComputer* cc = new StackChunkComputer(&coords, pb);
+	cc->setAccumulateOnly(true);
+
+	cache->restart();
+	MSComputer* computer = new MSComputer((ChunkComputer*)cc, (DataIO*)cache,
+	                                      n_thread, n_chunk, chunk_size, 
+	                                      false);
+	computer->run();
+	double averageFlux = cc->flux();
+
+	delete computer;
+	delete cc;
+	delete pb;
+
+	return averageFlux;
+}/*}}}*/
+
+double cpp_stack_vislist(int nvis, int* infiletypes, char** infiles, /*{{{*/
+                         int* infileoptions,
+                         int pbtype, char* pbfile, double* pbpar, int npbpar,
+                         double* x, double* y, double* weight, int nstack,
+                         double* res_flux, double* res_weight,
+                         int n_thread, int n_chunk, int chunk_size)
+{
+	for(int i = 0; i < nvis; i++)
+	{
+		res_flux[i] = 0.;
+		res_weight[i] = 0.;
+		if(infiletypes[i] != FILE_TYPE_MS)
+		{
+			cerr << "Stacking of several inputs is only supported for ms "
+			     << "files." << endl;
+			return 0.;
+		}
+	}
+
+	DataIO** data = new DataIO*[nvis];
+	for(int i = 0; i < nvis; i++)
+		data[i] = NULL;
+	try
+	{
+		for(int i = 0; i < nvis; i++)
+			data[i] = (DataIO*)new msio(infiles[i], "", 
+			                            msColumn(infileoptions[i]), 
+			                            false, "", false);
+	}
+	catch(fileException e)
+	{
+		std::cerr << e.what() << std::endl;
+		for(int i = 0; i < nvis; i++)
+			delete data[i];
+		delete[] data;
+		return 0.;
+	}
+
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
+
+	// Positions are computed relative to the fields of each input, so 
+	// each needs coordinates and a computer of its own. Weights are 
+	// always scaled with the primary beam, so that they are comparable 
+	// between inputs.
+	Coords** coords = new Coords*[nvis];
+	StackChunkComputer** cc = new StackChunkComputer*[nvis];
+	ChunkComputer** computers = new ChunkComputer*[nvis];
+	for(int i = 0; i < nvis; i++)
+	{
+		coords[i] = new Coords(x, y, weight, nstack);
+		cc[i] = new StackChunkComputer(coords[i], pb);
+		cc[i]->setAccumulateOnly(true);
+		cc[i]->setRedoWeights(true);
+		computers[i] = (ChunkComputer*)cc[i];
+	}
+
+	MSComputer* computer = new MSComputer(computers, data, nvis,
+	                                      n_thread, n_chunk, chunk_size);
+	computer->run();
+
+	double sum = 0., sumWeight = 0.;
+	for(int i = 0; i < nvis; i++)
+	{
+		res_weight[i] = cc[i]->weight();
+		res_flux[i] = res_weight[i] > 0. ? cc[i]->flux() : 0.;
+		sum += res_flux[i]*res_weight[i];
+		sumWeight += res_weight[i];
+	}
+
+	delete computer;
+	for(int i = 0; i < nvis; i++)
+	{
+		delete cc[i];
+		delete coords[i];
+	}
+	delete[] cc;
+	delete[] computers;
+	delete[] coords;
+	delete[] data;
+	delete pb;
+
+	return sumWeight > 0. ? sum/sumWeight : 0.;
+}/*}}}*/
+
 // Subtract a cl model from measurement set.
 void cpp_modsub(int infiletype, const char* infile, int infileoptions, /*{{{*/
                 int outfiletype, const char* outfile, int outfileoptions, 
                 const char* modelfile, 
                 int pbtype, const char* pbfile, double* pbpar, int npbpar,
                 bool subtract, bool use_cuda,
-				const bool selectField, const char* field)
+				const bool selectField, const char* field,
+				bool use_grid, double grid_cell, int grid_size,
+				bool skip_flagged,
+				int n_thread, int n_chunk, int chunk_size)
 {
-	PrimaryBeam* pb;// = new ImagePrimaryBeam(pbfile);
-	if(pbtype == PB_CONST)
-		pb = (PrimaryBeam*)new ConstantPrimaryBeam;
-	else if(pbtype == PB_MS)
-		pb = (PrimaryBeam*)new MSPrimaryBeam(pbfile);
-	else
-		pb = (PrimaryBeam*)new ConstantPrimaryBeam;
+	PrimaryBeam* pb = createPrimaryBeam(pbtype, pbfile, pbpar, npbpar);
 
 	Model* model = new Model(modelfile, subtract);
 
 
 	cout << "subtract = " << subtract << endl;
 	ChunkComputer* cc;
-	int n_thread = N_THREAD;
 	if(use_cuda)
 	{
 #ifdef USE_CUDA
@@ -333,9 +830,18 @@ void cpp_modsub(int infiletype, const char* infile, int infileoptions, /*{{{*/
 		return;
 #endif
 	}
+	else if(use_grid)
+	{
+		ModsubGridChunkComputer* mcc = new ModsubGridChunkComputer(model, pb, 
+		                                                  grid_cell, grid_size);
+		mcc->setSkipFlagged(skip_flagged);
+		cc = (ChunkComputer*) mcc;
+	}
 	else
 	{
-		cc = (ChunkComputer*) new ModsubChunkComputer(model, pb);
+		ModsubChunkComputer* mcc = new ModsubChunkComputer(model, pb);
+		mcc->setSkipFlagged(skip_flagged);
+		cc = (ChunkComputer*) mcc;
 	}
 	MSComputer* computer = NULL;
 	try
@@ -343,7 +849,8 @@ void cpp_modsub(int infiletype, const char* infile, int infileoptions, /*{{{*/
 		computer = new MSComputer(cc, 
 		                          infiletype, infile, infileoptions,
 		                          outfiletype, outfile, outfileoptions,
-		                          n_thread, selectField, field);
+		                          n_thread, n_chunk, chunk_size,
+		                          selectField, field);
 		computer->run();
 
 	}
@@ -359,3 +866,77 @@ void cpp_modsub(int infiletype, const char* infile, int infileoptions, /*{{{*/
 	delete pb;
 }
 /*}}}*/
+
+// Column of an ms file to read, from the options of _checkfile./*{{{*/
+int msColumn(int infileoptions)
+{
+	if(infileoptions & MS_DATACOLUMN_DATA)
+		return msio::col_data;
+	else if(infileoptions & MS_MODELCOLUMN_DATA)
+		return msio::col_model_data;
+	return msio::col_corrected_data;
+}/*}}}*/
+
+// Absolute path of file without symbolic links or relative parts./*{{{*/
+// Files that do not exist yet, like new outputs, are resolved through 
+// their directory.
+std::string canonicalPath(const char* file)
+{
+	char resolved[PATH_MAX];
+	if(realpath(file, resolved) != NULL)
+		return std::string(resolved);
+
+	std::string path(file);
+	while(path.size() > 1 and path[path.size()-1] == '/')
+		path.erase(path.size()-1);
+
+	size_t slash = path.rfind('/');
+	std::string dir = ".";
+	std::string name = path;
+	if(slash != std::string::npos)
+	{
+		dir = slash > 0 ? path.substr(0, slash) : "/";
+		name = path.substr(slash+1);
+	}
+
+	if(realpath(dir.c_str(), resolved) == NULL)
+		return path;
+	std::string resolvedDir(resolved);
+	if(resolvedDir != "/")
+		resolvedDir += "/";
+	return resolvedDir + name;
+}/*}}}*/
+
+// Primary beam parameters in pbpar for each pbtype:/*{{{*/
+// - PB_CONST: none.
+// - PB_MS: interpolation (PB_INTERP_NEAREST, PB_INTERP_LINEAR or 
+//   PB_INTERP_CUBIC), default PB_INTERP_LINEAR.
+// - PB_GAUSSIAN, PB_AIRY: dish diameter in m, and optionally reference
+//   frequency in Hz used when no frequency is known.
+PrimaryBeam* createPrimaryBeam(int pbtype, const char* pbfile, 
+                               double* pbpar, int npbpar)
+{
+	if(pbtype == PB_CONST)
+		return new ConstantPrimaryBeam;
+	else if(pbtype == PB_MS)
+		return new MSPrimaryBeam(pbfile, 
+		                         npbpar > 0 ? int(pbpar[0]) : PB_INTERP_LINEAR);
+	else if(pbtype == PB_GAUSSIAN || pbtype == PB_AIRY)
+	{
+		if(npbpar < 1)
+		{
+			cerr << "Analytic primary beam needs the dish diameter, "
+			     << "using constant primary beam." << endl;
+			return new ConstantPrimaryBeam;
+		}
+		double freq0 = npbpar > 1 ? pbpar[1] : 0.;
+		if(pbtype == PB_GAUSSIAN)
+			return new GaussianPrimaryBeam(pbpar[0], freq0);
+		else
+			return new AiryPrimaryBeam(pbpar[0], freq0);
+	}
+
+	cerr << "Primary beam type " << pbtype << " is not supported, "
+	     << "using constant primary beam." << endl;
+	return new ConstantPrimaryBeam;
+}/*}}}*/
@@ -15,7 +15,7 @@
 # along with this program; if not, write to the Free Software
 # Foundation, Inc., 51 Franklin Street, Fifth Floor,
 # Boston, MA  02110-1301, USA.
-from ctypes import c_double, POINTER, c_char_p, c_int, c_bool
+from ctypes import c_double, c_float, POINTER, c_char_p, c_int, c_bool, c_void_p
 import numpy as np
 import stacker
 import stacker.pb
@@ -26,17 +26,59 @@ c_stack.argtype = [c_int, c_char_p, c_int,
                    c_int, c_char_p, c_int,
                    c_int, c_char_p, POINTER(c_double), c_int,
                    POINTER(c_double), POINTER(c_double), POINTER(c_double),
-                   c_int, c_bool]
+                   c_int, c_bool, c_bool, c_double, c_int,
+                   c_int, c_int, c_int]
 c_stack_mc = stacker.libstacker.stack_mc
 c_stack_mc.argtype = [c_int, c_char_p, c_int,
                       c_int, c_char_p, POINTER(c_double), c_int,
                       POINTER(c_double), POINTER(c_double), POINTER(c_double),
                       c_int, c_int, POINTER(c_char_p), 
-                      POINTER(c_double), POINTER(c_double), c_int, c_bool]
+                      POINTER(c_double), POINTER(c_double), c_int, c_bool,
+                      c_int, c_int, c_int]
+c_stack_profile = stacker.libstacker.stack_profile
+c_stack_profile.restype = c_double
+c_stack_profile.argtype = [c_int, c_char_p, c_int,
+                           c_int, c_char_p, POINTER(c_double), c_int,
+                           POINTER(c_double), POINTER(c_double),
+                           POINTER(c_double), c_int,
+                           POINTER(c_double), c_int,
+                           POINTER(c_double), POINTER(c_double),
+                           c_float,
+                           c_int, c_int, c_int]
+c_stack_multi = stacker.libstacker.stack_multi
+c_stack_multi.argtype = [c_int, c_char_p, c_int, POINTER(c_char_p),
+                         c_int, c_char_p, POINTER(c_double), c_int,
+                         POINTER(c_double), POINTER(c_double),
+                         POINTER(c_double), POINTER(c_int), c_int,
+                         POINTER(c_double),
+                         c_int, c_int, c_int]
+c_stack_vislist = stacker.libstacker.stack_vislist
+c_stack_vislist.restype = c_double
+c_stack_vislist.argtype = [c_int, POINTER(c_int), POINTER(c_char_p),
+                           POINTER(c_int),
+                           c_int, c_char_p, POINTER(c_double), c_int,
+                           POINTER(c_double), POINTER(c_double),
+                           POINTER(c_double), c_int,
+                           POINTER(c_double), POINTER(c_double),
+                           c_int, c_int, c_int]
+c_open_cache = stacker.libstacker.open_cache
+c_open_cache.restype = c_void_p
+c_open_cache.argtype = [c_int, c_char_p, c_int, c_double]
+c_close_cache = stacker.libstacker.close_cache
+c_close_cache.argtype = [c_void_p]
+c_stack_cache = stacker.libstacker.stack_cache
+c_stack_cache.restype = c_double
+c_stack_cache.argtype = [c_void_p,
+                         c_int, c_char_p, POINTER(c_double), c_int,
+                         POINTER(c_double), POINTER(c_double),
+                         POINTER(c_double), c_int,
+                         c_int, c_int, c_int]
 
 
 def stack(coords, vis, outvis='', imagename='', cell='1arcsec', stampsize=32,
-          primarybeam='guess', datacolumn='corrected', use_cuda = False):
+          primarybeam='guess', datacolumn='corrected', use_cuda = False,
+          nufft=False, nufft_tolerance=None, nufft_imsize=None,
+          nthread=None, nchunk=None, chunksize=None):
     """
          Performs stacking in the uv domain.
 
@@ -53,6 +95,17 @@ def stack(coords, vis, outvis='', imagename='', cell='1arcsec', stampsize=32,
          imagename   -- Optional argument to image stacked data.
          cell        -- pixel size for target image
          stampsize   -- size of target image in pixels
+         nufft       -- Interpolate phase factors from a grid of the
+                        positions instead of summing over them for each
+                        visibility. Faster for large numbers of positions.
+         nufft_tolerance -- Largest relative error with nufft, default 1e-4.
+         nufft_imsize -- Size in pixels of the grid with nufft, default
+                        1024.
+         nthread     -- Number of threads, default is number of cpu cores.
+         nchunk      -- Number of chunks of data kept in memory,
+                        default is 2*nthread+2.
+         chunksize   -- Number of visibilities in each chunk, default
+                        depends on data shape and available memory.
 
          returns: Estimate of stacked flux assuming point source.
     """
@@ -115,7 +168,11 @@ def stack(coords, vis, outvis='', imagename='', cell='1arcsec', stampsize=32,
     flux = c_stack(infiletype, c_char_p(infilename), infileoptions,
                    outfiletype, c_char_p(outfilename), outfileoptions,
                    pbtype, c_char_p(pbfile), pbpars, pbnpars,
-                   x, y, weight, c_int(len(coords)), c_bool(use_cuda))
+                   x, y, weight, c_int(len(coords)), c_bool(use_cuda),
+                   c_bool(nufft), c_double(nufft_tolerance or 0.),
+                   c_int(nufft_imsize or 0),
+                   c_int(nthread or 0), c_int(nchunk or 0),
+                   c_int(chunksize or 0))
     stop = time.time()
 #     print("Started stack at {}".format(start))
 #     print("Finished stack at {}".format(stop))
@@ -134,6 +191,245 @@ def stack(coords, vis, outvis='', imagename='', cell='1arcsec', stampsize=32,
     return flux
 
 
+def stack_profile(coords, vis, bins, primarybeam='guess',
+                  datacolumn='corrected', bda_tolerance=0., nthread=None,
+                  nchunk=None, chunksize=None):
+    """
+         Stacked flux and its profile in uv distance, without writing any
+         stacked visibilities. Faster than stack when only the flux is
+         needed.
+
+         coords      -- A coordList object of all target coordinates.
+         vis         -- Input uv data file.
+         bins        -- Edges of uv-distance bins in metres.
+         bda_tolerance -- If larger than 0, rows of each baseline are
+                        averaged in time before stacking, for as long as
+                        the amplitude of the farthest target is reduced
+                        by less than this fraction. Short baselines are
+                        averaged most, which can speed up stacking of
+                        data with many short baselines considerably.
+         datacolumn, primarybeam, nthread, nchunk, chunksize -- See stack.
+
+         returns: Estimate of stacked flux assuming point source,
+                  weighted mean flux in each bin and sum of weights
+                  in each bin.
+    """
+    infiletype, infilename, infileoptions = stacker._checkfile(vis, datacolumn)
+
+    if primarybeam == 'guess':
+        primarybeam = stacker.pb.guesspb(vis)
+    elif primarybeam in ['constant', 'none'] or primarybeam is None:
+        primarybeam = stacker.pb.PrimaryBeamModel()
+    pbtype, pbfile, pbnpars, pbpars = primarybeam.cdata()
+
+    x = [p.x for p in coords]
+    y = [p.y for p in coords]
+    weight = [p.weight for p in coords]
+
+    x = (c_double*len(x))(*x)
+    y = (c_double*len(y))(*y)
+    weight = (c_double*len(weight))(*weight)
+
+    nbin = len(bins)-1
+    c_bins = (c_double*(nbin+1))(*bins)
+    res_flux = (c_double*nbin)(*([0]*nbin))
+    res_weight = (c_double*nbin)(*([0]*nbin))
+
+    flux = c_stack_profile(infiletype, c_char_p(infilename), infileoptions,
+                           pbtype, c_char_p(pbfile), pbpars, pbnpars,
+                           x, y, weight, c_int(len(coords)),
+                           c_bins, c_int(nbin), res_flux, res_weight,
+                           c_float(bda_tolerance),
+                           c_int(nthread or 0), c_int(nchunk or 0),
+                           c_int(chunksize or 0))
+
+    return flux, np.array(list(res_flux)), np.array(list(res_weight))
+
+
+def stack_multi(coords, vis, outvis=None, primarybeam='guess',
+                datacolumn='corrected', nthread=None, nchunk=None,
+                chunksize=None):
+    """
+         Performs stacking in the uv domain of several independent
+         coordinate lists, e.g. subsamples binned in mass or redshift.
+
+         All lists are stacked in a single pass over the data, this is
+         considerably faster than calling stack once for each list when
+         reading the data is the bottleneck.
+
+         coords      -- List of coordList objects, one for each target.
+         vis         -- Input uv data file.
+         outvis      -- List of output uv data files, one for each
+                        coordList. Use '' for a list, or None for all,
+                        to not save stacked visibilities. Must differ from
+                        vis and from each other.
+         datacolumn, primarybeam, nthread, nchunk, chunksize -- See stack.
+
+         returns: Estimate of stacked flux for each coordList.
+    """
+    import shutil
+    import os
+
+    ntarget = len(coords)
+    if outvis is None:
+        outvis = ['']*ntarget
+    if len(outvis) != ntarget:
+        raise RuntimeError('Number of output files does not match number of coordinate lists.')
+
+    infiletype, infilename, infileoptions = stacker._checkfile(vis, datacolumn)
+    outfilenames = []
+    for f in outvis:
+        if f != '':
+            if not os.access(f, os.F_OK):
+                shutil.copytree(vis, f)
+            outfilenames.append(stacker._checkfile(f, datacolumn)[1])
+        else:
+            outfilenames.append('')
+
+    if primarybeam == 'guess':
+        primarybeam = stacker.pb.guesspb(vis)
+    elif primarybeam in ['constant', 'none'] or primarybeam is None:
+        primarybeam = stacker.pb.PrimaryBeamModel()
+    pbtype, pbfile, pbnpars, pbpars = primarybeam.cdata()
+
+    x = []
+    y = []
+    weight = []
+    for coordlist in coords:
+        x.extend([p.x for p in coordlist])
+        y.extend([p.y for p in coordlist])
+        weight.extend([p.weight for p in coordlist])
+
+    x = (c_double*len(x))(*x)
+    y = (c_double*len(y))(*y)
+    weight = (c_double*len(weight))(*weight)
+    nstack = (c_int*ntarget)(*[len(coordlist) for coordlist in coords])
+    c_outfiles = (c_char_p*ntarget)(*outfilenames)
+    res_flux = (c_double*ntarget)(*([0]*ntarget))
+
+    c_stack_multi(infiletype, c_char_p(infilename), infileoptions,
+                  c_outfiles,
+                  pbtype, c_char_p(pbfile), pbpars, pbnpars,
+                  x, y, weight, nstack, c_int(ntarget), res_flux,
+                  c_int(nthread or 0), c_int(nchunk or 0),
+                  c_int(chunksize or 0))
+
+    return np.array(list(res_flux))
+
+
+def stack_vislist(coords, vislist, primarybeam='guess',
+                  datacolumn='corrected', nthread=None, nchunk=None,
+                  chunksize=None):
+    """
+         Stacked flux of several uv data files, e.g. one per execution
+         block, without writing any stacked visibilities.
+
+         All files are read concurrently and stacked by the same threads,
+         so reading is not limited to one file at a time. Visibility
+         weights are scaled with the primary beam for every file, so the
+         fluxes of the files can be combined with their weights.
+
+         coords      -- A coordList object of all target coordinates.
+         vislist     -- List of input uv data files.
+         primarybeam -- As for stack, 'guess' uses the first file and the
+                        same primary beam is used for all files.
+         datacolumn, nthread, nchunk, chunksize -- See stack.
+
+         returns: Weighted mean flux of all files, and flux and sum of
+                  weights of each file.
+    """
+    nvis = len(vislist)
+    files = [stacker._checkfile(vis, datacolumn) for vis in vislist]
+
+    if primarybeam == 'guess':
+        primarybeam = stacker.pb.guesspb(vislist[0])
+    elif primarybeam in ['constant', 'none'] or primarybeam is None:
+        primarybeam = stacker.pb.PrimaryBeamModel()
+    pbtype, pbfile, pbnpars, pbpars = primarybeam.cdata()
+
+    x = [p.x for p in coords]
+    y = [p.y for p in coords]
+    weight = [p.weight for p in coords]
+
+    x = (c_double*len(x))(*x)
+    y = (c_double*len(y))(*y)
+    weight = (c_double*len(weight))(*weight)
+
+    infiletypes = (c_int*nvis)(*[f[0] for f in files])
+    infilenames = (c_char_p*nvis)(*[f[1] for f in files])
+    infileoptions = (c_int*nvis)(*[f[2] for f in files])
+    res_flux = (c_double*nvis)(*([0]*nvis))
+    res_weight = (c_double*nvis)(*([0]*nvis))
+
+    flux = c_stack_vislist(c_int(nvis), infiletypes, infilenames,
+                           infileoptions,
+                           pbtype, c_char_p(pbfile), pbpars, pbnpars,
+                           x, y, weight, c_int(len(coords)),
+                           res_flux, res_weight,
+                           c_int(nthread or 0), c_int(nchunk or 0),
+                           c_int(chunksize or 0))
+
+    return flux, np.array(list(res_flux)), np.array(list(res_weight))
+
+
+class VisCache(object):
+    """
+         Uv data kept in memory, to be stacked many times without
+         reading the data again.
+
+         vis         -- Input uv data file.
+         datacolumn  -- See stack.
+         maxmemory   -- Memory the cache may use in bytes, default is
+                        half of the free memory.
+    """
+    def __init__(self, vis, datacolumn='corrected', maxmemory=None):
+        self.vis = vis
+        infiletype, infilename, infileoptions = stacker._checkfile(vis, datacolumn)
+        self._handle = c_open_cache(infiletype, c_char_p(infilename),
+                                    infileoptions, c_double(maxmemory or 0))
+        if not self._handle:
+            raise RuntimeError('Could not cache {0}, data may not fit in memory.'.format(vis))
+
+    def stack(self, coords, primarybeam='guess', nthread=None, nchunk=None,
+              chunksize=None):
+        """
+             Stacks the cached data without writing any stacked
+             visibilities.
+
+             coords      -- A coordList object of all target coordinates.
+             primarybeam, nthread, nchunk, chunksize -- See stack.
+
+             returns: Estimate of stacked flux assuming point source.
+        """
+        if primarybeam == 'guess':
+            primarybeam = stacker.pb.guesspb(self.vis)
+        elif primarybeam in ['constant', 'none'] or primarybeam is None:
+            primarybeam = stacker.pb.PrimaryBeamModel()
+        pbtype, pbfile, pbnpars, pbpars = primarybeam.cdata()
+
+        x = [p.x for p in coords]
+        y = [p.y for p in coords]
+        weight = [p.weight for p in coords]
+
+        x = (c_double*len(x))(*x)
+        y = (c_double*len(y))(*y)
+        weight = (c_double*len(weight))(*weight)
+
+        return c_stack_cache(c_void_p(self._handle),
+                             pbtype, c_char_p(pbfile), pbpars, pbnpars,
+                             x, y, weight, c_int(len(coords)),
+                             c_int(nthread or 0), c_int(nchunk or 0),
+                             c_int(chunksize or 0))
+
+    def close(self):
+        if self._handle:
+            c_close_cache(c_void_p(self._handle))
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+
 def noise(coords, vis, weighting='sigma2', imagenames=[], beam=None, nrand=50,
           stampsize=32, maskradius=None):
     """ Calculate noise using a Monte Carlo method, can be time consuming. """
@@ -150,25 +446,51 @@ def noise(coords, vis, weighting='sigma2', imagenames=[], beam=None, nrand=50,
         except ImportError:
             beam = 1/3600./180.*pi
 
+    # The data is read once, if it fits in memory.
+    try:
+        cache = VisCache(vis)
+        primarybeam = stacker.pb.guesspb(vis)
+    except RuntimeError:
+        cache = None
+
     dist = []
     for i in range(nrand):
         random_coords = stacker.randomizeCoords(coords, beam=beam)
         if weighting == 'sigma2':
             random_coords = stacker.image.calculate_sigma2_weights(
                 random_coords, imagenames, stampsize, maskradius)
-        dist.append(stack(random_coords, vis))
+        if cache is not None:
+            dist.append(cache.stack(random_coords, primarybeam))
+        else:
+            dist.append(stack(random_coords, vis))
+
+    if cache is not None:
+        cache.close()
 
     return np.std(np.real(np.array(dist)))
 
 
 def noise_fast(coords, models, vis, datacolumn='corrected',
                primarybeam='guess', use_cuda=True, 
-               nbin=None, bins=None):
-    """ Calculate noise using a Monte Carlo method, can be time consuming. """
+               nbin=None, bins=None,
+               nthread=None, nchunk=None, chunksize=None):
+    """
+         Calculate noise using a Monte Carlo method.
+
+         All Monte Carlo samples are stacked in a single pass over the data,
+         either on the gpu (use_cuda=True) or using all cpu cores.
+
+         coords  -- List of coordList objects, one for each sample.
+         models  -- List of cl files to add to data for each sample,
+                    '' for no model.
+         bins    -- Edges of uv-distance bins in metres (nbin+1 values).
+         nthread, nchunk, chunksize -- See stack.
+
+         returns: Summed flux and weight for each sample and bin,
+                  shape nmc*nbin.
+    """
     import stacker
 
-    if not use_cuda:
-        raise NotImplementedError
     if len(coords) != len(models):
         raise RuntimeError('Number of coordinate objects does not match number of models.')
     nmc = len(coords)
@@ -212,6 +534,8 @@ def noise_fast(coords, models, vis, datacolumn='corrected',
                x, y, weight, c_int(len(coords[0])), c_int(nmc),
                c_models,
                res_flux, res_weight, c_bins, c_int(nbin),
-               use_cuda)
+               c_bool(use_cuda),
+               c_int(nthread or 0), c_int(nchunk or 0),
+               c_int(chunksize or 0))
 
     return np.array(list(res_flux)), np.array(list(res_weight))